@@ -6,9 +6,19 @@
 *
 *   For: Linux Intel x86 processors.
 */
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
 #include "system.h"
 #include "../kern.h"
 
+/*  Wakes up halt_processor(), see sys_wake() */
+static int wake_fd = -1;
+
 /******************************************************************************
 *
 *   This function is called by task_create() to set up the stack frame.
@@ -110,12 +120,111 @@ void restore_task_context(TASK_CONTEXT tc, UINT code) {
 
 /******************************************************************************
 *
-*   Halt the processor.
+*   Halt the processor.  Under Linux, this sleeps until sys_wake() is called
+*   or a signal arrives.  If sys_wake_init() was never called, then it returns
+*   right away.
 *
 */
 void halt_processor() {
 
-    /* do nothing for now... */
+    uint64_t count;
+
+    if(wake_fd >= 0)
+        (void)read(wake_fd, &count, sizeof(count));
+}
+
+/******************************************************************************
+*
+*   Return the time in milliseconds from some point in the past.  It wraps
+*   around after about 49 days, so times have to be compared by subtracting.
+*
+*/
+UINT sys_time(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UINT)ts.tv_sec * 1000 + (UINT)(ts.tv_nsec / 1000000);
+}
+
+/******************************************************************************
+*
+*   Find out which of the file descriptors of "count" wait sources are ready
+*   and set their ready fields.  Wait up to "timeout" milliseconds for one of
+*   them, or forever if it is -1.  sys_wake() also ends the wait.  Return 
+*   the number of sources that are ready, or -1 on an error.
+*
+*/
+int sys_poll(WAIT_SOURCE **sources, UINT count, int timeout) {
+
+    struct pollfd fds[WAIT_MAX_FDS + 1];
+    uint64_t wakes;
+    UINT idx, nfds = 0;
+    int ready = 0;
+
+    for(idx = 0; idx < count && idx < WAIT_MAX_FDS; idx++) {
+        fds[nfds].fd = sources[idx]->fd;
+        fds[nfds].events = 0;
+        if(TESTFLAG(sources[idx]->mask, WAIT_READ))
+            fds[nfds].events |= POLLIN;
+        if(TESTFLAG(sources[idx]->mask, WAIT_WRITE))
+            fds[nfds].events |= POLLOUT;
+        nfds++;
+    }
+    if(timeout != 0 && wake_fd >= 0) {
+        fds[nfds].fd = wake_fd;
+        fds[nfds].events = POLLIN;
+        nfds++;
+    }
+
+    if(poll(fds, nfds, timeout) < 0)
+        return -1;
+
+    for(idx = 0; idx < count && idx < WAIT_MAX_FDS; idx++) {
+        sources[idx]->ready = 0;
+        if(TESTFLAG(fds[idx].revents, POLLIN))
+            SETFLAG(sources[idx]->ready, WAIT_READ);
+        if(TESTFLAG(fds[idx].revents, POLLOUT))
+            SETFLAG(sources[idx]->ready, WAIT_WRITE);
+        /*  Errors and hang ups are ready for whatever was asked, so that
+            the task finds out about them when it reads or writes.  */
+        if(TESTFLAG(fds[idx].revents, POLLERR | POLLHUP | POLLNVAL))
+            sources[idx]->ready = sources[idx]->mask;
+        if(sources[idx]->ready)
+            ready++;
+    }
+    if(idx < nfds && TESTFLAG(fds[idx].revents, POLLIN))
+        (void)read(wake_fd, &wakes, sizeof(wakes));
+
+    return ready;
+}
+
+/******************************************************************************
+*
+*   Set up the eventfd that sys_wake() uses to end halt_processor().  Return
+*   TASK_ERROR if it can't be created.
+*
+*/
+int sys_wake_init(void) {
+
+    if(wake_fd < 0 && (wake_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+        return TASK_ERROR;
+
+    return TASK_SUCCESS;
+}
+
+/******************************************************************************
+*
+*   End halt_processor(), or make the next call to it return right away.  
+*   This is safe to call from any thread and from a signal handler.
+*
+*/
+void sys_wake(void) {
+
+    uint64_t one = 1;
+
+    if(wake_fd >= 0)
+        (void)write(wake_fd, &one, sizeof(one));
 }
 
 /******************************************************************************
@@ -153,3 +262,70 @@ int sys_check_stack(TCB *tcb) {
     return val;
 }
 
+/******************************************************************************
+*
+*   Get the memory that the global heap is made from.  The memory is mapped
+*   from the kernel rather than taken from malloc() so that it can be backed
+*   by huge pages.  If explicit huge pages (MAP_HUGETLB) are not available, 
+*   then the region is aligned to a huge page and transparent huge pages are
+*   requested for it.  If that does not work, then normal pages are used.
+*
+*   If SYS_MEMORY_LOCK is set, then every page is touched and the region is
+*   locked in RAM so that the control loop never takes a page fault.  Failing
+*   to lock the memory is not an error, since the pages are already present.
+*
+*   Returns NULL if there is no memory at all.
+*/
+UCHAR *sys_get_memory(UINT size, UINT flags) {
+
+    UCHAR *ptr = MAP_FAILED;
+    UPTR skip;
+    UINT idx, page;
+
+    /*  Whole pages only, so that the region can be trimmed.  */
+    page = sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) & ~(page - 1);
+
+#ifdef MAP_HUGETLB
+    if(TESTFLAG(flags, SYS_MEMORY_HUGE)) {
+        ptr = mmap(NULL, 
+                   (size + SYS_HUGE_PAGE_SIZE - 1) & ~(SYS_HUGE_PAGE_SIZE - 1),
+                   PROT_READ | PROT_WRITE, 
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, 
+                   -1, 0);
+    }
+#endif
+
+    if(ptr == MAP_FAILED && TESTFLAG(flags, SYS_MEMORY_HUGE)) {
+        /*  Map a huge page more than needed and trim it so that the region
+            starts on a huge page boundry.  */
+        ptr = mmap(NULL, size + SYS_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ptr != MAP_FAILED) {
+            skip = (SYS_HUGE_PAGE_SIZE - ((UPTR)ptr & (SYS_HUGE_PAGE_SIZE - 1)))
+                        & (SYS_HUGE_PAGE_SIZE - 1);
+            if(skip != 0)
+                munmap(ptr, skip);
+            munmap(ptr + skip + size, SYS_HUGE_PAGE_SIZE - skip);
+            ptr += skip;
+#ifdef MADV_HUGEPAGE
+            madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+        }
+    }
+
+    if(ptr == MAP_FAILED) {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ptr == MAP_FAILED && (ptr = malloc(size)) == NULL)
+            return NULL;
+    }
+
+    if(TESTFLAG(flags, SYS_MEMORY_LOCK)) {
+        for(idx = 0; idx < size; idx += page)
+            ptr[idx] = 0;
+        mlock(ptr, size);
+    }
+
+    return ptr;
+}
@@ -7,7 +7,22 @@
 #ifndef __SYSTEM_HEADER_DEFINED__
 #define __SYSTEM_HEADER_DEFINED__
 
+#include <pthread.h>
+
 #define save_task_context(c)        setjmp(c)
 #define restore_task_context(c, v)  longjmp(c, v)
 
+/* size of the huge pages that the global heap is backed with */
+#define SYS_HUGE_PAGE_SIZE          (2 * 1024 * 1024)
+
+/* locks that protect data shared by more than one host thread, such as 
+    the global heap */
+typedef pthread_mutex_t SYS_LOCK;
+#define SYS_LOCK_INITIALIZER        PTHREAD_MUTEX_INITIALIZER
+#define sys_lock(l)                 pthread_mutex_lock(l)
+#define sys_unlock(l)               pthread_mutex_unlock(l)
+
+/* storage class of data that each host thread has it's own copy of */
+#define SYS_THREAD_LOCAL            __thread
+
 #endif /* __SYSTEM_HEADER_DEFINED__ */
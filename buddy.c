@@ -0,0 +1,305 @@
+/******************************************************************************
+*
+*   Buddy system for the large blocks of the global heap.
+*
+*     Most of what the global heap is asked for is large: task heaps of
+*   DEFAULT_HEAP_SIZE and bigger, and the extents that task heaps grow by.
+*   If these came from the first fit heap, creating and killing tasks would
+*   leave holes all over it.  Instead, they come from a buddy system, and the
+*   small kernel objects come from a first fit heap of their own.  See
+*   init_global_heap() in memory.c.
+*
+*     Every block in the buddy system is a power of two bytes, from
+*   BUDDY_MIN_SIZE up, and starts at an offset that is a multiple of it's
+*   size.  The "buddy" of a block is the block of the same size that it was
+*   split from, which is found by flipping the bit of the offset that is equal
+*   to the size.  Allocating splits a bigger free block in half until it is
+*   the right size, and freeing merges a block with it's buddy for as long as
+*   the buddy is free.  Both take at most one step per order.
+*
+*     There are no headers in the blocks.  A map with one byte for every
+*   BUDDY_MIN_SIZE bytes holds the order of the block that starts there, and
+*   whether it is free.  That way a request for exactly 4096 bytes takes a
+*   4096 byte block and nothing more.  The free blocks of each order are kept
+*   in a list that is linked through the blocks themselves.
+*
+*     These functions do no locking.  memory.c calls them with the global
+*   heap lock held.
+*
+\*****************************************************************************/
+#include "kern.h"
+
+#define BUDDY_ORDERS    (BUDDY_MAX_ORDER - BUDDY_MIN_ORDER + 1)
+#define BUDDY_FREE      0x80    /* map flag for a free block */
+#define BUDDY_BLOCK(o)  ((UPTR)1 << (o))
+
+typedef struct __bn__ {
+    struct __bn__ *next, *prev;
+} BUDDY_NODE;
+
+static struct {
+    UCHAR *base;    /* first block, aligned to a page */
+    UPTR size;      /* number of bytes managed */
+    UCHAR *map;     /* order of the block that starts in each minimum block */
+    BUDDY_NODE *free_list[BUDDY_ORDERS];
+
+    /* statistics */
+    UINT used;
+    UINT high_water;
+    UINT used_blocks;
+    UINT free_blocks;
+    UINT allocs;
+    UINT frees;
+    UINT failures;
+} buddy;
+
+static void push_block(UINT order, UPTR offset);
+static void pull_block(UINT order, UPTR offset);
+
+/******************************************************************************
+*
+*   Set up the buddy system in the memory given.  The map takes the first
+*   part of it.  Return the number of bytes that are managed, which is zero
+*   if the memory is too small to be worth it.
+*
+*/
+UINT buddy_init(UCHAR *start, UINT size) {
+
+    UPTR nblocks, offset, skip;
+    UINT order;
+
+    /*  The map needs a byte for each minimum block.  Room for it is taken
+        from the front, then the blocks start on a page boundry so that page
+        aligned requests can be met.  */
+    if(size <= HEAP_ALIGN_PAGE)
+        return 0;
+    nblocks = (size - HEAP_ALIGN_PAGE) / (BUDDY_MIN_SIZE + 1);
+    if(nblocks == 0)
+        return 0;
+
+    buddy.map = start;
+    start += nblocks;
+    skip = (HEAP_ALIGN_PAGE - ((UPTR)start & (HEAP_ALIGN_PAGE - 1))) &
+                (HEAP_ALIGN_PAGE - 1);
+
+    buddy.base = start + skip;
+    buddy.size = nblocks * BUDDY_MIN_SIZE;
+    for(offset = 0; offset < nblocks; offset++)
+        buddy.map[offset] = 0;
+    for(order = 0; order < BUDDY_ORDERS; order++)
+        buddy.free_list[order] = NULL;
+
+    /*  Cut the memory into the biggest blocks that fit and are aligned. */
+    for(offset = 0; offset < buddy.size; offset += BUDDY_BLOCK(order)) {
+        order = BUDDY_MAX_ORDER;
+        while((offset & (BUDDY_BLOCK(order) - 1)) != 0 ||
+                        BUDDY_BLOCK(order) > buddy.size - offset)
+            order--;
+        push_block(order, offset);
+    }
+
+    return (UINT)buddy.size;
+}
+
+
+/******************************************************************************
+*
+*   Return non-zero if the pointer lies in the buddy system.
+*
+*/
+int buddy_contains(void *ptr) {
+
+    return (UCHAR *)ptr >= buddy.base && (UCHAR *)ptr < buddy.base + buddy.size;
+}
+
+
+/******************************************************************************
+*
+*   Allocate a block of at least "size" bytes whose address is a multiple of
+*   "align", which can be up to a page.  Return NULL if there is no free block
+*   that is big enough.
+*
+*/
+void *buddy_alloc(UINT size, UINT align) {
+
+    UINT order, split;
+    UPTR offset;
+
+    if(buddy.size == 0 || align == 0 || (align & (align - 1)) != 0 ||
+                align > HEAP_ALIGN_PAGE)
+        return NULL;
+
+    for(order = BUDDY_MIN_ORDER;
+                order <= BUDDY_MAX_ORDER &&
+                        (BUDDY_BLOCK(order) < size || BUDDY_BLOCK(order) < align);
+                order++)
+        ;
+
+    /*  Find the smallest free block that will do */
+    for(split = order; split <= BUDDY_MAX_ORDER; split++) {
+        if(buddy.free_list[split - BUDDY_MIN_ORDER] != NULL)
+            break;
+    }
+
+    if(split > BUDDY_MAX_ORDER) {
+        buddy.failures++;
+        return NULL;
+    }
+
+    offset = (UCHAR *)buddy.free_list[split - BUDDY_MIN_ORDER] - buddy.base;
+    pull_block(split, offset);
+
+    /*  Split it in half until it is the right size.  The top half of each
+        split is free.  */
+    while(split > order) {
+        split--;
+        push_block(split, offset + BUDDY_BLOCK(split));
+    }
+
+    buddy.map[offset >> BUDDY_MIN_ORDER] = order;
+    buddy.used += BUDDY_BLOCK(order);
+    buddy.used_blocks++;
+    buddy.allocs++;
+    if(buddy.used > buddy.high_water)
+        buddy.high_water = buddy.used;
+
+    return buddy.base + offset;
+}
+
+
+/******************************************************************************
+*
+*   Free a block and merge it with it's buddy for as long as the buddy is
+*   free.  If the pointer is not an allocated block, then return non-zero.
+*
+*/
+int buddy_free(void *ptr) {
+
+    UPTR offset, boffset;
+    UINT order;
+
+    if(!buddy_contains(ptr))
+        return 1;
+
+    offset = (UCHAR *)ptr - buddy.base;
+    if(offset & (BUDDY_MIN_SIZE - 1))
+        return 2;
+
+    order = buddy.map[offset >> BUDDY_MIN_ORDER];
+    if(order < BUDDY_MIN_ORDER || order > BUDDY_MAX_ORDER ||
+                (offset & (BUDDY_BLOCK(order) - 1)))
+        return 3;   /* free, or not the start of a block */
+
+    buddy.map[offset >> BUDDY_MIN_ORDER] = 0;
+    buddy.used -= BUDDY_BLOCK(order);
+    buddy.used_blocks--;
+    buddy.frees++;
+
+    while(order < BUDDY_MAX_ORDER) {
+        boffset = offset ^ BUDDY_BLOCK(order);
+        if(boffset + BUDDY_BLOCK(order) > buddy.size ||
+                    buddy.map[boffset >> BUDDY_MIN_ORDER] != (order | BUDDY_FREE))
+            break;
+
+        pull_block(order, boffset);
+        buddy.map[boffset >> BUDDY_MIN_ORDER] = 0;
+        if(boffset < offset)
+            offset = boffset;
+        order++;
+    }
+
+    push_block(order, offset);
+
+    return 0;
+}
+
+
+/******************************************************************************
+*
+*   Return the size of the block that a pointer from buddy_alloc() points to.
+*
+*/
+UINT buddy_block_size(void *ptr) {
+
+    UINT order;
+
+    order = buddy.map[((UCHAR *)ptr - buddy.base) >> BUDDY_MIN_ORDER];
+    return (UINT)BUDDY_BLOCK(order & ~BUDDY_FREE);
+}
+
+
+/******************************************************************************
+*
+*   Add the statistics of the buddy system to the ones in "stats".
+*
+*/
+void buddy_stats(HEAP_STATS *stats) {
+
+    UINT order;
+
+    stats->size += (UINT)buddy.size;
+    stats->used += buddy.used;
+    stats->free += (UINT)buddy.size - buddy.used;
+    stats->high_water += buddy.high_water;
+    stats->used_blocks += buddy.used_blocks;
+    stats->free_blocks += buddy.free_blocks;
+    stats->allocs += buddy.allocs;
+    stats->frees += buddy.frees;
+    stats->failures += buddy.failures;
+
+    for(order = BUDDY_MAX_ORDER; order >= BUDDY_MIN_ORDER; order--) {
+        if(buddy.free_list[order - BUDDY_MIN_ORDER] != NULL) {
+            if(BUDDY_BLOCK(order) > stats->largest_free)
+                stats->largest_free = (UINT)BUDDY_BLOCK(order);
+            break;
+        }
+    }
+}
+
+
+/******************************************************************************
+*
+*   STATIC FUNCTIONS
+*
+*/
+/******************************************************************************
+*
+*   Put a block on the free list of it's order and mark it free in the map.
+*
+*/
+static void push_block(UINT order, UPTR offset) {
+
+    BUDDY_NODE *node, **list;
+
+    list = &buddy.free_list[order - BUDDY_MIN_ORDER];
+    node = (BUDDY_NODE *)(buddy.base + offset);
+    node->prev = NULL;
+    node->next = *list;
+    if(*list != NULL)
+        (*list)->prev = node;
+    *list = node;
+
+    buddy.map[offset >> BUDDY_MIN_ORDER] = order | BUDDY_FREE;
+    buddy.free_blocks++;
+}
+
+
+/******************************************************************************
+*
+*   Take a block off of the free list of it's order.
+*
+*/
+static void pull_block(UINT order, UPTR offset) {
+
+    BUDDY_NODE *node;
+
+    node = (BUDDY_NODE *)(buddy.base + offset);
+    if(node->prev != NULL)
+        node->prev->next = node->next;
+    else
+        buddy.free_list[order - BUDDY_MIN_ORDER] = node->next;
+    if(node->next != NULL)
+        node->next->prev = node->prev;
+
+    buddy.free_blocks--;
+}
@@ -0,0 +1,233 @@
+/******************************************************************************
+*
+*   Channels.
+*
+*     A channel carries fixed size items from one task, the producer, to
+*   another, the consumer, such as from a driver to a filter.  It is a ring
+*   of slots that is allocated once, in the consumer's heap, so sending and
+*   receiving only copy an item in or out of a slot.  Nothing is allocated
+*   and there are no lists to walk.
+*
+*     There is only one producer and one consumer, so at most one task can
+*   be blocked on a channel: the producer when the ring is full or the
+*   consumer when it is empty.  The other one makes it runnable again.  A
+*   task can also wait for a channel along with other things with 
+*   task_wait_any().  The channel goes away with the consumer, and a 
+*   producer that is blocked on it then gets TASK_ERROR, or a NULL channel
+*   in it's wait source.  A producer that is not blocked must not use it
+*   after that.
+*
+*/
+#include "kern.h"
+
+/* defined in wait.c */
+extern void wake_channel_waiter(CHANNEL *ch, TCB *tcb, int closed);
+
+static int wait_channel(CHANNEL *ch, TCB *tcb);
+static void wake_channel(CHANNEL *ch, int closed);
+
+/******************************************************************************
+*
+*   Create a channel of "slots" items of "slot_size" bytes that the current
+*   task receives from.  Return NULL if there is no memory.
+*
+*/
+CHANNEL *channel_create(UINT slot_size, UINT slots) {
+
+    CHANNEL *ch;
+    TCB *tcb;
+
+    if(slot_size == 0 || slots == 0 || (tcb = get_current_task_tcb()) == NULL)
+        return NULL;
+
+    /*  Too big to add up */
+    if(slots > ((UINT)-1 - sizeof(CHANNEL)) / slot_size)
+        return NULL;
+
+    if((ch = tcb_alloc(tcb, sizeof(CHANNEL) + slot_size * slots)) == NULL)
+        return NULL;
+
+    ch->slot_size = slot_size;
+    ch->slots = slots;
+    ch->consumer = tcb;
+    ch->ring = (UCHAR *)(ch + 1);
+
+    ch->next = tcb->channels;
+    tcb->channels = ch;
+
+    return ch;
+}
+
+
+/******************************************************************************
+*
+*   Destroy a channel.  Only the consumer can do it.  A producer that is
+*   blocked on it gets TASK_ERROR.
+*
+*/
+int channel_destroy(CHANNEL *ch) {
+
+    CHANNEL *prev;
+    TCB *tcb;
+
+    if(ch == NULL || (tcb = get_current_task_tcb()) != ch->consumer)
+        return TASK_ERROR;
+
+    if((prev = tcb->channels) == ch)
+        tcb->channels = ch->next;
+    else {
+        while(prev != NULL && prev->next != ch)
+            prev = prev->next;
+        if(prev == NULL)
+            return TASK_ERROR;
+        prev->next = ch->next;
+    }
+
+    wake_channel(ch, 1);
+
+    return tcb_free(tcb, ch)? TASK_ERROR: TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Copy an item into the next slot of a channel.  If the ring is full, the
+*   task is blocked until the consumer empties a slot.  This does not call
+*   the scheduler otherwise.  Return TASK_ERROR if the channel is destroyed
+*   while it waits.
+*
+*/
+int channel_send(CHANNEL *ch, void *item) {
+
+    TCB *tcb;
+
+    if(ch == NULL || item == NULL || (tcb = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    while(ch->count == ch->slots) {
+        if(wait_channel(ch, tcb) != TASK_SUCCESS)
+            return TASK_ERROR;
+    }
+
+    copy_memory(ch->ring + ch->head * ch->slot_size, item, ch->slot_size);
+    if(++ch->head == ch->slots)
+        ch->head = 0;
+    ch->count++;
+
+    wake_channel(ch, 0);
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Copy the oldest item out of a channel.  Only the consumer can do it.  If
+*   the ring is empty, the task is blocked until the producer fills a slot.
+*   This does not call the scheduler otherwise.
+*
+*/
+int channel_receive(CHANNEL *ch, void *item) {
+
+    TCB *tcb;
+
+    if(ch == NULL || item == NULL ||
+                (tcb = get_current_task_tcb()) != ch->consumer)
+        return TASK_ERROR;
+
+    while(ch->count == 0) {
+        if(wait_channel(ch, tcb) != TASK_SUCCESS)
+            return TASK_ERROR;
+    }
+
+    copy_memory(item, ch->ring + ch->tail * ch->slot_size, ch->slot_size);
+    if(++ch->tail == ch->slots)
+        ch->tail = 0;
+    ch->count--;
+
+    wake_channel(ch, 0);
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Take care of the channels of a task that is exiting.  The ones that it
+*   receives from go away with it's heap, so the producers that are blocked
+*   on them are told.  If it is blocked on a channel, then it is taken off.
+*
+*/
+void free_task_channels(TCB *tcb) {
+
+    CHANNEL *ch;
+
+    if((ch = tcb->channel_wait) != NULL && ch->waiting == tcb)
+        ch->waiting = NULL;
+    tcb->channel_wait = NULL;
+
+    for(ch = tcb->channels; ch != NULL; ch = ch->next)
+        wake_channel(ch, 1);
+    tcb->channels = NULL;
+}
+
+
+/******************************************************************************
+*
+*   STATIC FUNCTIONS
+*
+*/
+/******************************************************************************
+*
+*   Block a task on a channel until the other side makes it runnable.
+*   Return TASK_ERROR if the channel was destroyed in the mean time.
+*
+*/
+static int wait_channel(CHANNEL *ch, TCB *tcb) {
+
+    ch->waiting = tcb;
+    tcb->channel_wait = ch;
+    SETFLAG(tcb->flags, WAIT_FOR_CHANNEL);
+    tcb->status = INCR_STATUS(tcb);
+    yield();
+
+    /*  The channel is gone if this was cleared */
+    if(tcb->channel_wait == NULL)
+        return TASK_ERROR;
+
+    tcb->channel_wait = NULL;
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Make the task that is blocked on a channel runnable, if there is one.
+*   If "closed" is non-zero, then the channel is going away.
+*
+*/
+static void wake_channel(CHANNEL *ch, int closed) {
+
+    TCB *tcb;
+
+    if((tcb = ch->waiting) == NULL)
+        return;
+
+    ch->waiting = NULL;
+
+    /*  It is waiting in task_wait_any(), or it was and something else
+        made it runnable first. */
+    if(!TESTFLAG(tcb->flags, WAIT_FOR_CHANNEL)) {
+        wake_channel_waiter(ch, tcb, closed);
+        return;
+    }
+
+    if(closed)
+        tcb->channel_wait = NULL;
+
+    if(tcb->status == TASK_KILLED)
+        return;     /* it will be deleted, leave it that way */
+
+    CLEARFLAG(tcb->flags, WAIT_FOR_CHANNEL);
+    tcb->status = DECR_STATUS(tcb);
+}
@@ -7,16 +7,89 @@
 *   semaphore are really event driven.  I.E. when a semaphore is released, an 
 *   event is generated that communicates with the task that is waiting on it.
 *
+*     An event is put straight into the destination task's event queue, and
+*   if the task is waiting for one, it is made runnable right there.  The 
+*   event task is only used for events that are deferred with defer_event(),
+*   which are delivered the next time it runs.
+*
+*     Events are used a lot, so the ones that are free'd are kept in a list
+*   and used again instead of going back to the global heap.  Once enough 
+*   of them have been allocated, sending an event does not touch the heap.
+*
+*     An event can carry EVENT_DATA_SIZE bytes of data, so that the receiver
+*   does not need to ask the sender what happened.  A task can wait for only
+*   some types of events with wait_event_match().  The other events stay in
+*   the queue, and they do not wake the task up.
+*
+*     Code that is not running in a task, such as another thread or a signal
+*   handler, can't touch the event queues.  It uses inject_event() instead,
+*   which puts the event in a ring of EVENT_INJECT_SIZE slots without any
+*   locks.  The scheduler moves the events from the ring to the task queues
+*   every time it runs.  While anything is attached with inject_attach(), 
+*   the scheduler halts the processor when no task is runnable, instead of
+*   returning, and inject_event() wakes it up.
+*
+*     A task that only needs to know that something happened, and not how
+*   many times, can have the events of a type and subtype coalesced with
+*   event_coalesce().  While one of them is in the queue, the next ones are
+*   merged into it, so the queue does not grow and the task is not woken up
+*   again.  The newest sender and data are kept.
+*
+*     Every task's queue holds at most DEFAULT_EVENT_LIMIT events, so that a
+*   task that is stuck can't use up the global heap.  What happens to an 
+*   event that does not fit is set for each queue with event_queue_limit():
+*   the sender gets an error, the sender waits for room, or the newest or 
+*   oldest event is dropped.  The events that are lost are counted.  Events
+*   that are delivered by the scheduler or the event task can't wait, so 
+*   they are refused if the policy is to wait.
+*
+*     A queue is split into EVENT_BANDS priority bands, each a list of it's
+*   own, so that an urgent event does not wait behind a lot of routine ones.
+*   A task receives from the most urgent band that has anything in it, and
+*   the events in a band are received in the order that they were sent.  A
+*   bit is kept for each band that is not empty, so finding the event to
+*   receive does not depend on how many are queued.
+*
 */
 #include "kern.h"
 
+/* does an event match the type mask of a wait_event_match() */
+#define EVENT_MATCHES(e, m) ((m) == EVENT_MATCH_ANY || \
+            (TESTFLAG(m, EVENT_MATCH_EXACT)? \
+                (e)->type == ((m) & ~EVENT_MATCH_EXACT): ((e)->type & (m)) != 0))
+
+/* defined in memory.c */
+extern void *global_alloc_system(UINT size);
+
 static EVENT_QUEUE *system_event_queue;
 static TCB *event_task_tcb;
+static EVENT *event_free_list = NULL;
+static UINT event_free_count = 0;
+
+/*  The injection ring.  The head is where the producers put events and the
+    tail is where the scheduler takes them from. */
+static EVENT_INJECT inject_ring[EVENT_INJECT_SIZE];
+static UINT inject_head = 0;
+static UINT inject_tail = 0;
+static UINT inject_users = 0;
+static UINT inject_dropped = 0;
 
 static void free_event(EVENT *event);
-static EVENT *allocate_event(void);
+static EVENT *allocate_event(int system);
 static EVENT *dequeue_event(EVENT_QUEUE *eq);
+static EVENT *take_event(EVENT_QUEUE *eq, UINT mask);
 static void enqueue_event(EVENT_QUEUE *eq, EVENT *event);
+static EVENT *make_event(TCB *tcb, UINT type, UINT subtype);
+static EVENT *fill_event(EVENT *event, TCB *tcb, UINT type, UINT subtype);
+static EVENT_KEY *find_key(TCB *tcb, UINT type, UINT subtype);
+static int wait_for_room(TCB *tcb);
+static void make_room(EVENT_QUEUE *eq);
+static void wake_sender(EVENT_QUEUE *eq, int gone);
+static void unlink_event(EVENT_QUEUE *eq, EVENT *event, EVENT *prev);
+static UINT take_events(EVENT_QUEUE *eq, EVENT_INFO *buf, UINT max);
+
+/*  Used by topic.c too */
+int deliver_event(EVENT *event);
 static int event_task(void);
 
 /******************************************************************************
@@ -26,6 +99,20 @@ static int event_task(void);
 */
 int init_event_system(void) {
 
+    EVENT *event;
+    UINT count;
+
+    /*  Each slot of the ring is ready for the first turn */
+    for(count = 0; count < EVENT_INJECT_SIZE; count++)
+        inject_ring[count].seq = count;
+
+    /*  Fill the free list so the first events do not need the heap. */
+    for(count = 0; count < EVENT_PREALLOC; count++) {
+        if((event = global_alloc(sizeof(EVENT))) == NULL)
+            return TASK_ERROR;
+        free_event(event);
+    }
+
     /*  Create the event queue used by the event task  */
     if((system_event_queue = global_alloc(sizeof(EVENT_QUEUE))) == NULL) {
         return TASK_ERROR;
@@ -54,40 +141,172 @@ int init_event_system(void) {
 *
 *   Generate an event.
 *
-*   This funciton indicates to the event task that there was an event in the 
-*   system.  It unblocks the event task and calls the scheduler.  Generating 
-*   an event never blocks the sender.
+*   The event is put in the destination's event queue and the destination is
+*   made runnable if it was waiting for an event.  Then the scheduler is 
+*   called, so that the destination runs now if it has a higher priority.  
+*   The sender is only blocked if the destination's queue is full and it's
+*   policy is EVENT_QUEUE_BLOCK.
 */
 int generate_event(TCB *tcb, UINT type, UINT subtype) {
 
     EVENT *event;
-    TCB *local_tcb;
     
-    /*  If the tcb parameter is NULL, then use the current TCB.  Has the effect 
-        of sending an event to the running task. */
-    if(tcb == NULL) 
-        local_tcb = get_current_task_tcb();
-    else
-        local_tcb = tcb;
+    if(wait_for_room(tcb) != TASK_SUCCESS)
+        return TASK_ERROR;
+
+    if((event = make_event(tcb, type, subtype)) == NULL) 
+        return TASK_ERROR;
         
-    /*  Get the memory for the event from the global heap */
-    if((event = allocate_event()) == NULL) 
+    if(deliver_event(event) < 0)
         return TASK_ERROR;
+    yield();
         
-    event->type = type;
-    event->subtype = subtype;
-    event->destination = local_tcb;
-    event->sender = get_current_task_tcb();
-    event->next = NULL;
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Post an event.
+*
+*   This is the same as generate_event() except that the scheduler is not
+*   called.  If the destination has a higher priority than the sender, then
+*   it runs the next time that the sender yields.
+*/
+int post_event(TCB *tcb, UINT type, UINT subtype) {
+
+    EVENT *event;
+    
+    if(wait_for_room(tcb) != TASK_SUCCESS)
+        return TASK_ERROR;
+
+    if((event = make_event(tcb, type, subtype)) == NULL) 
+        return TASK_ERROR;
+        
+    if(deliver_event(event) < 0)
+        return TASK_ERROR;
+        
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Post an event with data.
+*
+*   Up to EVENT_DATA_SIZE bytes are copied into the event.  The rest of the
+*   event's data is zero.  Like post_event(), this does not call the 
+*   scheduler.
+*/
+int post_event_data(TCB *tcb, UINT type, UINT subtype, void *data, UINT size) {
+
+    EVENT *event;
+    
+    if(size > EVENT_DATA_SIZE || (size > 0 && data == NULL))
+        return TASK_ERROR;
+
+    if(wait_for_room(tcb) != TASK_SUCCESS)
+        return TASK_ERROR;
+
+    if((event = make_event(tcb, type, subtype)) == NULL) 
+        return TASK_ERROR;
+        
+    copy_memory(event->data, data, size);
+    if(deliver_event(event) < 0)
+        return TASK_ERROR;
+        
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Post an event in a priority band.
+*
+*   The event is received before the ones in the less urgent bands, even if
+*   they were sent first.  Like post_event(), this does not call the 
+*   scheduler.
+*/
+int post_event_priority(TCB *tcb, UINT type, UINT subtype, UINT band) {
+
+    EVENT *event;
+    
+    if(band >= EVENT_BANDS)
+        return TASK_ERROR;
+
+    if(wait_for_room(tcb) != TASK_SUCCESS)
+        return TASK_ERROR;
+
+    if((event = make_event(tcb, type, subtype)) == NULL) 
+        return TASK_ERROR;
+        
+    event->band = (UCHAR)band;
+    if(deliver_event(event) < 0)
+        return TASK_ERROR;
+        
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Post a batch of events.
+*
+*   All of the events are delivered first, then the scheduler is called once
+*   if any of them woke up a task that has a higher priority than the sender.
+*   Return the number of events that were posted.  If there are less than 
+*   "count", then an event could not be allocated or was refused, and the
+*   rest were not sent.
+*/
+int post_events(EVENT_POST *batch, UINT count) {
+
+    EVENT *event;
+    TCB *current;
+    UINT idx;
+    int preempt = 0, woke;
     
-    /*  Save it in the queue.  */
+    current = get_current_task_tcb();
+
+    for(idx = 0; idx < count; idx++) {
+        if(wait_for_room(batch[idx].destination) != TASK_SUCCESS)
+            break;
+        event = make_event(batch[idx].destination, batch[idx].type, 
+                    batch[idx].subtype);
+        if(event == NULL) 
+            break;
+        if((woke = deliver_event(event)) < 0)
+            break;
+        if(woke && current != NULL &&
+                    event->destination->priority < current->priority)
+            preempt = 1;
+    }
+
+    if(preempt)
+        yield();
+        
+    return (int)idx;
+}
+
+
+/******************************************************************************
+*
+*   Defer an event.
+*
+*   The event is given to the event task, which delivers it the next time
+*   that it runs.  This is for code that should not touch the destination
+*   task directly, such as a handler that runs in the middle of another 
+*   task.  It does not call the scheduler.
+*/
+int defer_event(TCB *tcb, UINT type, UINT subtype) {
+
+    EVENT *event;
+    
+    if((event = make_event(tcb, type, subtype)) == NULL) 
+        return TASK_ERROR;
+        
+    /*  Save it in the queue and tell the event task to run.  */
     enqueue_event(event_task_tcb->event_queue, event);
-    /*  Tell the event task to run.  */
     event_task_tcb->status = TASK_RUNABLE;
-    
-    /*  Since the event task is a very high priority, it is practaclly certain
-        this it will be the next task to run.  Do not, however, depend on it. */
-    yield();
         
     return TASK_SUCCESS;
 }
@@ -160,6 +379,7 @@ TCB *wait_event(UINT *type, UINT *subtype) {
     /*  Wait for the event by yielding to the scheduler if there is no event
         ready for delivery. */
     while(tcb->event_queue->num_events == 0) {
+        tcb->event_match = EVENT_MATCH_ANY;
         tcb->status = INCR_STATUS(tcb);
         SETFLAG(tcb->flags, WAIT_FOR_EVENT);
         yield();
@@ -180,6 +400,349 @@ TCB *wait_event(UINT *type, UINT *subtype) {
 }
 
 
+/******************************************************************************
+*
+*   Syncronously receive some types of events.
+*
+*   This waits for the first event in the queue whose type has any of the
+*   bits of "mask" set, and leaves the other events in the queue.  The task
+*   is not woken up by events that do not match.  The type, subtype and data
+*   of the event are returned, if the pointers are not NULL.  "data" must 
+*   have room for EVENT_DATA_SIZE bytes.  Return the sender.
+*
+*/
+TCB *wait_event_match(UINT mask, UINT *type, UINT *subtype, void *data) {
+
+    TCB *tcb;
+    EVENT *event;
+    
+    /*  Operate on the current task only. */
+    tcb = get_current_task_tcb();
+    
+    while((event = take_event(tcb->event_queue, mask)) == NULL) {
+        tcb->event_match = mask;
+        tcb->status = INCR_STATUS(tcb);
+        SETFLAG(tcb->flags, WAIT_FOR_EVENT);
+        yield();
+    }
+    
+    tcb = event->sender;
+    if(type != NULL)
+        *type = event->type;
+    if(subtype != NULL)
+        *subtype = event->subtype;
+    if(data != NULL)
+        copy_memory(data, event->data, EVENT_DATA_SIZE);
+    
+    free_event(event);
+    
+    return tcb;    
+}
+
+
+/******************************************************************************
+*
+*   Asyncrounously receive a batch of events.
+*
+*   Up to "max" events are moved out of the queue into "buf", in the order 
+*   that wait_event() would return them.  Like check_event(), the scheduler
+*   is called, but only once for the whole batch.  Return the number of 
+*   events, which is zero if there were none, or TASK_ERROR if "buf" is NULL
+*   or "max" is zero.
+*
+*/
+int check_events(EVENT_INFO *buf, UINT max) {
+
+    UINT count;
+
+    if(buf == NULL || max == 0)
+        return TASK_ERROR;
+
+    count = take_events(get_current_task_tcb()->event_queue, buf, max);
+
+    /*  As with all system calls, this function causes a potential task 
+        switch. */
+    yield();
+
+    return (int)count;
+}
+
+
+/******************************************************************************
+*
+*   Syncronously receive a batch of events.
+*
+*   This waits until there is at least one event in the queue, then moves up
+*   to "max" of them into "buf" like check_events().  The scheduler is only
+*   called if the task has to wait.  Return the number of events, or 
+*   TASK_ERROR if "buf" is NULL or "max" is zero.
+*
+*/
+int wait_events(EVENT_INFO *buf, UINT max) {
+
+    TCB *tcb;
+
+    if(buf == NULL || max == 0)
+        return TASK_ERROR;
+
+    /*  Operate on the current task only. */
+    tcb = get_current_task_tcb();
+
+    while(tcb->event_queue->num_events == 0) {
+        tcb->event_match = EVENT_MATCH_ANY;
+        tcb->status = INCR_STATUS(tcb);
+        SETFLAG(tcb->flags, WAIT_FOR_EVENT);
+        yield();
+    }
+
+    return (int)take_events(tcb->event_queue, buf, max);
+}
+
+
+/******************************************************************************
+*
+*   Count the events in a task's queue whose type matches a mask, without
+*   taking them out.  A NULL TCB means the current task.
+*
+*/
+UINT event_pending(TCB *tcb, UINT mask) {
+
+    EVENT *event;
+    UINT band, count = 0;
+
+    if(tcb == NULL && (tcb = get_current_task_tcb()) == NULL)
+        return 0;
+
+    for(band = 0; band < EVENT_BANDS; band++) {
+        for(event = tcb->event_queue->first[band]; event != NULL; 
+                    event = event->next) {
+            if(EVENT_MATCHES(event, mask))
+                count++;
+        }
+    }
+
+    return count;
+}
+
+
+/******************************************************************************
+*
+*   Set the most events that a task's queue holds and what happens to the
+*   ones that do not fit.  A limit of 0 means no limit.  A NULL TCB means 
+*   the current task.  If the limit is made smaller than the number of events
+*   in the queue, then none are dropped, but no more fit until it is below
+*   the limit.
+*
+*/
+int event_queue_limit(TCB *tcb, UINT limit, UINT policy) {
+
+    EVENT_QUEUE *eq;
+
+    if(tcb == NULL && (tcb = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    if(policy > EVENT_QUEUE_DROP_OLDEST)
+        return TASK_ERROR;
+
+    eq = tcb->event_queue;
+    eq->limit = limit;
+    eq->policy = policy;
+
+    /*  The senders that are waiting can try again */
+    while(eq->senders != NULL)
+        wake_sender(eq, 0);
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Get the statistics of a task's event queue.  A NULL TCB means the 
+*   current task.
+*
+*/
+int event_queue_stats(TCB *tcb, EVENT_QUEUE_STATS *stats) {
+
+    EVENT_QUEUE *eq;
+
+    if(tcb == NULL && (tcb = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    if(stats == NULL)
+        return TASK_ERROR;
+
+    eq = tcb->event_queue;
+    stats->depth = eq->num_events;
+    stats->peak = eq->peak;
+    stats->drops = eq->drops;
+    stats->limit = eq->limit;
+    stats->policy = eq->policy;
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Coalesce the events of a type and subtype that are sent to the current
+*   task, or stop coalescing them if "on" is zero.  Return TASK_ERROR if the
+*   task already coalesces EVENT_COALESCE_KEYS of them or if there is no 
+*   memory.
+*
+*/
+int event_coalesce(UINT type, UINT subtype, int on) {
+
+    TCB *tcb;
+    EVENT_KEY *key;
+    UINT idx;
+
+    if((tcb = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    if((key = find_key(tcb, type, subtype)) != NULL) {
+        if(!on) {
+            /*  A pending event stays in the queue, but is not merged into
+                any more.  */
+            if(key->pending != NULL)
+                CLEARFLAG(key->pending->flags, EVENT_COALESCED);
+            key->used = 0;
+            key->pending = NULL;
+        }
+        return TASK_SUCCESS;
+    }
+
+    if(!on)
+        return TASK_SUCCESS;
+
+    if(tcb->coalesce == NULL &&
+                (tcb->coalesce = global_alloc(sizeof(EVENT_KEY) * 
+                            EVENT_COALESCE_KEYS)) == NULL)
+        return TASK_ERROR;
+
+    for(idx = 0; idx < EVENT_COALESCE_KEYS; idx++) {
+        key = &tcb->coalesce[idx];
+        if(!key->used) {
+            key->type = type;
+            key->subtype = subtype;
+            key->used = 1;
+            key->pending = NULL;
+            return TASK_SUCCESS;
+        }
+    }
+
+    return TASK_ERROR;
+}
+
+
+/******************************************************************************
+*
+*   Inject an event from outside of the tasker.
+*
+*   This can be called from any thread and from a signal handler.  It does
+*   not allocate and does not lock.  The event is delivered the next time 
+*   that the scheduler runs, and it's sender is NULL.  The destination task
+*   must still exist then.  Return TASK_ERROR if the ring is full.
+*/
+int inject_event(TCB *tcb, UINT type, UINT subtype) {
+
+    EVENT_INJECT *slot;
+    UINT pos, seq;
+
+    if(tcb == NULL)
+        return TASK_ERROR;
+
+    /*  Claim a slot.  If the slot at the head has not been taken by the 
+        scheduler since the last turn, then the ring is full. */
+    pos = __atomic_load_n(&inject_head, __ATOMIC_RELAXED);
+    while(1) {
+        slot = &inject_ring[pos & (EVENT_INJECT_SIZE - 1)];
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if(seq == pos) {
+            if(__atomic_compare_exchange_n(&inject_head, &pos, pos + 1, 1,
+                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        }
+        else if((int)(seq - pos) < 0) {
+            __atomic_fetch_add(&inject_dropped, 1, __ATOMIC_RELAXED);
+            return TASK_ERROR;
+        }
+        else
+            pos = __atomic_load_n(&inject_head, __ATOMIC_RELAXED);
+    }
+
+    /*  Fill it in and give it to the scheduler */
+    slot->destination = tcb;
+    slot->type = type;
+    slot->subtype = subtype;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+    sys_wake();
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Attach to or detach from the injection ring.  While anything is attached,
+*   the scheduler waits for injected events when no task is runnable, rather
+*   than returning.  Return the number of events that were dropped because
+*   the ring was full.
+*/
+UINT inject_attach(void) {
+
+    if(__atomic_fetch_add(&inject_users, 1, __ATOMIC_ACQ_REL) == 0)
+        sys_wake_init();
+
+    return __atomic_load_n(&inject_dropped, __ATOMIC_RELAXED);
+}
+
+UINT inject_detach(void) {
+
+    __atomic_fetch_sub(&inject_users, 1, __ATOMIC_ACQ_REL);
+    sys_wake();
+
+    return __atomic_load_n(&inject_dropped, __ATOMIC_RELAXED);
+}
+
+
+/******************************************************************************
+*
+*   Move the injected events to the tasks' queues.  This is called by the 
+*   scheduler every time it runs.  A slot that a producer has claimed but 
+*   not filled in yet stops it until the next time.  Return non-zero if 
+*   anything is attached to the ring.
+*/
+int drain_injected_events(void) {
+
+    EVENT_INJECT *slot;
+    EVENT *event;
+
+    while(1) {
+        slot = &inject_ring[inject_tail & (EVENT_INJECT_SIZE - 1)];
+        if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != inject_tail + 1)
+            break;
+
+        /*  Whatever task is current did not ask for this event, so it is
+            not charged for it or held to it's allocation policy. */
+        if((event = allocate_event(1)) == NULL)
+            break;  /* try again the next time */
+        fill_event(event, slot->destination, slot->type, slot->subtype);
+
+        /*  The slot is ready for the next turn of the ring */
+        __atomic_store_n(&slot->seq, inject_tail + EVENT_INJECT_SIZE, 
+                    __ATOMIC_RELEASE);
+        inject_tail++;
+
+        event->sender = NULL;
+        deliver_event(event);
+    }
+
+    return __atomic_load_n(&inject_users, __ATOMIC_ACQUIRE) != 0;
+}
+
+
 /******************************************************************************
 *
 *   STATIC FUNCTIONS
@@ -187,10 +750,10 @@ TCB *wait_event(UINT *type, UINT *subtype) {
 */
 /******************************************************************************
 *
-*   Event task.  The generate_event() function actually sends events to this
-*   task.  This task then unblocks the receiver if nessesary and places the 
-*   event in the receiver's event queue.  Then it blocks it's self and yields
-*   the processor to other tasks.
+*   Event task.  The defer_event() function sends events to this task.  This
+*   task then unblocks the receiver if nessesary and places the event in the
+*   receiver's event queue.  Then it blocks it's self and yields the 
+*   processor to other tasks.
 *
 *   This funciton could be considered a template for other tasks.
 *
@@ -205,16 +768,7 @@ static int event_task(void) {
         /* get each event, one at a time */
         while((event = dequeue_event(event_task_tcb->event_queue)) != NULL) {
 /* TODO: do some sanity checking.... */
-
-            /*  If the destination task is blocked for an event, then make it
-                runable. */
-            if(TESTFLAG(event->destination->flags, WAIT_FOR_EVENT)) {            
-                event->destination->status = DECR_STATUS(event->destination);
-                CLEARFLAG(event->destination->flags, WAIT_FOR_EVENT);
-            }
-
-            /* send the event to the destination */
-            enqueue_event(event->destination->event_queue, event);
+            deliver_event(event);
         }
                 
         /* stop the event task */
@@ -232,24 +786,28 @@ static int event_task(void) {
 *
 *   Enqueue an event.
 *
-*   Events are always added of the end of the linked list.
+*   Events are always added of the end of the list of their band.
 *
 */
 static void enqueue_event(EVENT_QUEUE *eq, EVENT *event) {
 
-    if(eq->last == NULL) {
-        /* init the last and the first pointer in the queue. */
-        eq->last = event;         
-        eq->first = event;
+    UINT band = event->band;
+
+    event->next = NULL;
+    if(eq->last[band] == NULL) {
+        /* init the last and the first pointer in the band. */
+        eq->last[band] = event;         
+        eq->first[band] = event;
+        SETFLAG(eq->bands, 1 << band);
     }
     else {
-        /* else add it to the end of the queue */
-        eq->last->next = event;
-        eq->last = event;
-        event->next = NULL;
+        /* else add it to the end of the band */
+        eq->last[band]->next = event;
+        eq->last[band] = event;
     }
     
-    eq->num_events++;
+    if(++eq->num_events > eq->peak)
+        eq->peak = eq->num_events;
 }
 
 
@@ -257,27 +815,23 @@ static void enqueue_event(EVENT_QUEUE *eq, EVENT *event) {
 *
 *   Dequeue an event.
 *
-*   Events are always taken from the start of the linked list.
+*   Events are always taken from the start of the most urgent band that has
+*   any.  That is the lowest bit that is set in the band bits.
 *
 */
 static EVENT *dequeue_event(EVENT_QUEUE *eq) {
 
     EVENT *event;
     
-    if(eq->first == NULL) {
+    if(eq->bands == 0) {
         /*  There is no event to return so return NULL */
         event = NULL;
     }
     else {
         /*  Else there is an event, so remove it from the list and get ready
             to return a pointer to it.  */
-        event = eq->first;
-        eq->first = eq->first->next;
-        /* check if the queue is empty. */
-        if(eq->first == NULL) 
-            /* indicate that condition to the add function */
-            eq->last = NULL;
-        eq->num_events--;
+        event = eq->first[__builtin_ctz(eq->bands)];
+        unlink_event(eq, event, NULL);
     }
     
     return event;
@@ -286,28 +840,435 @@ static EVENT *dequeue_event(EVENT_QUEUE *eq) {
 
 /******************************************************************************
 *
-*   Allocate an event on the global heap.  Return a pointer to it or NULL if
-*   there was an error.  Simply a convience function to hide details.
+*   Take the first event that matches a type mask out of a queue, wherever
+*   it is.  The bands are looked at from the most urgent one.  Return NULL 
+*   if there is none.
+*
+*/
+static EVENT *take_event(EVENT_QUEUE *eq, UINT mask) {
+
+    EVENT *event, *prev;
+    UINT band;
+    
+    for(band = 0; band < EVENT_BANDS; band++) {
+        prev = NULL;
+        for(event = eq->first[band]; event != NULL; 
+                    prev = event, event = event->next) {
+            if(EVENT_MATCHES(event, mask)) {
+                unlink_event(eq, event, prev);
+                return event;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+
+/******************************************************************************
+*
+*   Take an event out of the list of it's band.  "prev" is the event before
+*   it in the band, or NULL if it is the first one.
+*
+*/
+static void unlink_event(EVENT_QUEUE *eq, EVENT *event, EVENT *prev) {
+
+    UINT band = event->band;
+
+    if(prev == NULL)
+        eq->first[band] = event->next;
+    else
+        prev->next = event->next;
+    if(eq->last[band] == event)
+        eq->last[band] = prev;
+    /* indicate when the band is empty */
+    if(eq->first[band] == NULL)
+        CLEARFLAG(eq->bands, 1 << band);
+    eq->num_events--;
+    make_room(eq);
+}
+
+
+/******************************************************************************
+*
+*   Move up to "max" events out of a queue into a buffer and free them.
+*   Return the number that were moved.
+*
+*/
+static UINT take_events(EVENT_QUEUE *eq, EVENT_INFO *buf, UINT max) {
+
+    EVENT *event;
+    UINT count;
+
+    for(count = 0; count < max && (event = dequeue_event(eq)) != NULL; 
+                count++) {
+        buf[count].sender = event->sender;
+        buf[count].type = event->type;
+        buf[count].subtype = event->subtype;
+        copy_memory(buf[count].data, event->data, EVENT_DATA_SIZE);
+        free_event(event);
+    }
+
+    return count;
+}
+
+
+/******************************************************************************
+*
+*   Allocate an event and fill it in.  If the tcb parameter is NULL, then the
+*   event is for the current task.
+*
+*/
+static EVENT *make_event(TCB *tcb, UINT type, UINT subtype) {
+
+    EVENT *event;
+
+    if(tcb == NULL && (tcb = get_current_task_tcb()) == NULL)
+        return NULL;
+
+    if((event = allocate_event(0)) == NULL) 
+        return NULL;
+        
+    return fill_event(event, tcb, type, subtype);
+}
+
+
+/******************************************************************************
+*
+*   Fill in a new event for a task.  Return the event.
+*
+*/
+static EVENT *fill_event(EVENT *event, TCB *tcb, UINT type, UINT subtype) {
+
+    UINT idx;
+
+    event->type = type;
+    event->subtype = subtype;
+    event->destination = tcb;
+    event->sender = get_current_task_tcb();
+    event->next = NULL;
+    event->band = EVENT_BAND_NORMAL;
+    for(idx = 0; idx < EVENT_DATA_SIZE; idx++)
+        event->data[idx] = 0;
+
+    return event;
+}
+
+
+/******************************************************************************
+*
+*   Find the coalescing key of a type and subtype for a task.  Return NULL
+*   if they are not coalesced.
+*
+*/
+static EVENT_KEY *find_key(TCB *tcb, UINT type, UINT subtype) {
+
+    UINT idx;
+
+    if(tcb->coalesce == NULL)
+        return NULL;
+
+    for(idx = 0; idx < EVENT_COALESCE_KEYS; idx++) {
+        if(tcb->coalesce[idx].used && tcb->coalesce[idx].type == type &&
+                    tcb->coalesce[idx].subtype == subtype)
+            return &tcb->coalesce[idx];
+    }
+
+    return NULL;
+}
+
+
+/******************************************************************************
+*
+*   If a task's queue is full and it's policy is to make the sender wait,
+*   then wait until there is room.  A task can't wait for it's own queue.
+*   Return TASK_ERROR if the task exited while the sender was waiting.
+*
+*/
+static int wait_for_room(TCB *tcb) {
+
+    TCB *self, *last;
+    EVENT_QUEUE *eq;
+
+    if((self = get_current_task_tcb()) == NULL || tcb == NULL || tcb == self)
+        return TASK_SUCCESS;
+
+    eq = tcb->event_queue;
+    while(eq->policy == EVENT_QUEUE_BLOCK && eq->limit != 0 &&
+                eq->num_events >= eq->limit) {
+        /*  Wait at the end of the line */
+        self->room_next = NULL;
+        if((last = eq->senders) == NULL)
+            eq->senders = self;
+        else {
+            while(last->room_next != NULL)
+                last = last->room_next;
+            last->room_next = self;
+        }
+        self->room_wait = eq;
+        SETFLAG(self->flags, WAIT_FOR_ROOM);
+        self->status = INCR_STATUS(self);
+        yield();
+
+        /*  The queue is gone if the task exited */
+        if(self->room_wait == NULL)
+            return TASK_ERROR;
+        self->room_wait = NULL;
+    }
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   An event was taken out of a queue, so let the first sender that is
+*   waiting for room try again.
 *
 */
-static EVENT *allocate_event(void) {
+static void make_room(EVENT_QUEUE *eq) {
 
-    return (EVENT *)global_alloc(sizeof(EVENT));
+    if(eq->senders != NULL && (eq->limit == 0 || eq->num_events < eq->limit))
+        wake_sender(eq, 0);
 }
 
 
 /******************************************************************************
 *
-*   Free an event from the global heap.  Since events are never returned to
-*   a user task, this funciton is static in scope.
+*   Make the first sender that is waiting for room in a queue runnable.  If
+*   "gone" is non-zero, then the queue's task is exiting, and the sender is
+*   told so.
+*
+*/
+static void wake_sender(EVENT_QUEUE *eq, int gone) {
+
+    TCB *tcb = eq->senders;
+
+    eq->senders = tcb->room_next;
+    tcb->room_next = NULL;
+    if(gone)
+        tcb->room_wait = NULL;
+    CLEARFLAG(tcb->flags, WAIT_FOR_ROOM);
+    if(tcb->status != TASK_KILLED)
+        tcb->status = DECR_STATUS(tcb);
+}
+
+
+/******************************************************************************
+*
+*   Allocate an event.  It comes from the free list if there is one there,
+*   otherwise from the global heap.  If "system" is non-zero, then the event
+*   is not for the current task, so the allocation is not checked against
+*   it's policy.  Return a pointer to it or NULL if there was an error.
+*
+*/
+static EVENT *allocate_event(int system) {
+
+    EVENT *event;
+
+    if((event = event_free_list) == NULL)
+        return (EVENT *)((system)? global_alloc_system(sizeof(EVENT)):
+                                   global_alloc(sizeof(EVENT)));
+
+    event_free_list = event->next;
+    event_free_count--;
+
+    return event;
+}
+
+
+/******************************************************************************
+*
+*   Free an event.  It is kept in the free list unless there are already 
+*   EVENT_CACHE_LIMIT there.  Since events are never returned to a user task,
+*   this funciton is static in scope.
 *
 */
 static void free_event(EVENT *event) {
 
-    global_free(event);
+    EVENT_KEY *key;
+
+    /*  Events of this type and subtype can be queued again */
+    if(TESTFLAG(event->flags, EVENT_COALESCED)) {
+        key = find_key(event->destination, event->type, event->subtype);
+        if(key != NULL && key->pending == event)
+            key->pending = NULL;
+        CLEARFLAG(event->flags, EVENT_COALESCED);
+    }
+
+    /*  An event that is part of something else, such as a subscription, is 
+        only taken off of the queue. */
+    if(TESTFLAG(event->flags, EVENT_STATIC)) {
+        CLEARFLAG(event->flags, EVENT_QUEUED);
+        return;
+    }
+
+    if(event_free_count >= EVENT_CACHE_LIMIT) {
+        global_free(event);
+        return;
+    }
+
+    event->next = event_free_list;
+    event_free_list = event;
+    event_free_count++;
+}
+
+
+/******************************************************************************
+*
+*   Free the events that are still in the queue of a task that is exiting,
+*   and the deferred events for it that are waiting for the event task.
+*
+*/
+void free_task_events(TCB *tcb) {
+
+    EVENT *event, *next, *before;
+    EVENT_QUEUE *eq;
+    TCB *prev;
+    UINT band;
+
+    if(tcb->event_queue == NULL)
+        return;
+
+    while((event = dequeue_event(tcb->event_queue)) != NULL)
+        free_event(event);
+
+    /*  Deferred events for it that the event task has not delivered yet */
+    if(event_task_tcb != NULL && tcb != event_task_tcb) {
+        eq = event_task_tcb->event_queue;
+        for(band = 0; band < EVENT_BANDS; band++) {
+            before = NULL;
+            for(event = eq->first[band]; event != NULL; event = next) {
+                next = event->next;
+                if(event->destination == tcb) {
+                    unlink_event(eq, event, before);
+                    free_event(event);
+                }
+                else
+                    before = event;
+            }
+        }
+    }
+
+    /*  Tasks that are waiting to send to it get an error */
+    while(tcb->event_queue->senders != NULL)
+        wake_sender(tcb->event_queue, 1);
+
+    /*  And if it was waiting to send to some other task, it is not now */
+    if(TESTFLAG(tcb->flags, WAIT_FOR_ROOM)) {
+        if((prev = tcb->room_wait->senders) == tcb)
+            tcb->room_wait->senders = tcb->room_next;
+        else {
+            while(prev != NULL && prev->room_next != tcb)
+                prev = prev->room_next;
+            if(prev != NULL)
+                prev->room_next = tcb->room_next;
+        }
+        CLEARFLAG(tcb->flags, WAIT_FOR_ROOM);
+    }
+
+    if(tcb->coalesce != NULL) {
+        global_free(tcb->coalesce);
+        tcb->coalesce = NULL;
+    }
+}
+
+
+/******************************************************************************
+*
+*   Put an event in the destination task's queue, and make the task runnable
+*   if it is waiting for this type of event.  Return non-zero if the task was
+*   woken up.  If the event is merged into one that is in the queue already,
+*   or dropped because the queue is full, then it is free'd.  Return -1 if
+*   the queue is full and the sender should get an error.  This is used by
+*   topic.c as well.
+*
+*/
+int deliver_event(EVENT *event) {
+
+    TCB *tcb = event->destination;
+    EVENT_QUEUE *eq = tcb->event_queue;
+    EVENT_KEY *key = NULL;
+    EVENT *oldest = NULL, *prev = NULL;
+    UINT band;
+
+    if(!TESTFLAG(event->flags, EVENT_STATIC))
+        key = find_key(tcb, event->type, event->subtype);
+
+    if(key != NULL && key->pending != NULL) {
+        key->pending->sender = event->sender;
+        copy_memory(key->pending->data, event->data, EVENT_DATA_SIZE);
+        free_event(event);
+        return 0;
+    }
+
+    /*  Static events are never more than one in a queue, so they always 
+        fit. */
+    if(!TESTFLAG(event->flags, EVENT_STATIC) && eq->limit != 0 &&
+                eq->num_events >= eq->limit) {
+        eq->drops++;
+        /*  The oldest event of the least urgent band is dropped, unless the
+            new one is less urgent than all of them.  Static events are the
+            only notice of something else, such as messages that are still
+            waiting, so they are never dropped. */
+        if(eq->policy == EVENT_QUEUE_DROP_OLDEST) {
+            for(band = EVENT_BANDS; oldest == NULL && band-- > event->band; ) {
+                prev = NULL;
+                for(oldest = eq->first[band]; oldest != NULL &&
+                            TESTFLAG(oldest->flags, EVENT_STATIC); 
+                            oldest = oldest->next)
+                    prev = oldest;
+            }
+        }
+        if(oldest != NULL) {
+            unlink_event(eq, oldest, prev);
+            free_event(oldest);
+        }
+        else {
+            free_event(event);
+            return (eq->policy == EVENT_QUEUE_DROP_NEWEST)? 0: -1;
+        }
+    }
+
+    if(key != NULL) {
+        key->pending = event;
+        SETFLAG(event->flags, EVENT_COALESCED);
+    }
+
+    enqueue_event(eq, event);
+
+    if(TESTFLAG(tcb->flags, WAIT_FOR_EVENT) &&
+                EVENT_MATCHES(event, tcb->event_match)) {
+        tcb->status = DECR_STATUS(tcb);
+        CLEARFLAG(tcb->flags, WAIT_FOR_EVENT | WAIT_FOR_ANY);
+        return 1;
+    }
+
+    return 0;
 }
 
 
+/******************************************************************************
+*
+*   Take an event out of a task's queue, wherever it is, and free it.  Return
+*   TASK_ERROR if it is not in the queue.
+*
+*/
+int remove_event(TCB *tcb, EVENT *event) {
+
+    EVENT *prev = NULL, *ptr;
+    EVENT_QUEUE *eq = tcb->event_queue;
+
+    for(ptr = eq->first[event->band]; ptr != NULL && ptr != event; 
+                ptr = ptr->next)
+        prev = ptr;
 
+    if(ptr == NULL)
+        return TASK_ERROR;
 
+    unlink_event(eq, event, prev);
 
+    free_event(event);
+
+    return TASK_SUCCESS;
+}
@@ -0,0 +1,213 @@
+/******************************************************************************
+*
+*   Relocatable memory (handles).
+*
+*     A task that runs for a long time and allocates blocks of many sizes
+*   will cut it's heap up into free blocks that are too small to use, even
+*   though there is enough free memory all together.  A block that is
+*   allocated through a handle can be moved by the kernel to close up the
+*   free space around it.  See task_heap_compact() in memory.c.
+*
+*     A handle is a pointer to a master pointer, and the master pointer
+*   points to the data.  When a block is moved, only the master pointer is
+*   changed, so the handle stays good.  The master pointers are allocated
+*   HANDLE_CHUNK at a time from the global heap, so that they are not in the
+*   way of the blocks that move in the task's heap.  They are free'd when 
+*   the task exits.  The first word of a handle block is the address of it's
+*   master pointer, so that the compaction can find it.
+*
+*     Compaction is done by the scheduler between tasks, and when the task's
+*   heap is too full to allocate from.  A pointer that is gotten from a
+*   handle is good until the task yields or allocates memory.  If it has to
+*   be kept longer than that, then lock the handle first.
+*
+*/
+#include "kern.h"
+
+static void **get_master(TCB *tcb);
+static void *handle_block(HANDLE handle);
+
+/******************************************************************************
+*
+*   Allocate "size" bytes from the current task's heap that the kernel can
+*   move.  The memory is cleared.  Return the handle, or NULL if there is not
+*   enough memory.
+*
+*/
+HANDLE task_handle_alloc(UINT size) {
+
+    TCB *tcb;
+    void **master;
+    UCHAR *ptr;
+
+    if((tcb = get_current_task_tcb()) == NULL)
+        return NULL;
+
+    if(size + sizeof(void **) < size)
+        return NULL;    /* wrapped around */
+
+    if((master = get_master(tcb)) == NULL)
+        return NULL;
+
+    if((ptr = tcb_alloc(tcb, size + sizeof(void **))) == NULL) {
+        *master = tcb->handle_free;
+        tcb->handle_free = master;
+        return NULL;
+    }
+
+    SETFLAG(HEAP_PTR_TO_HCB(ptr)->size, HEAP_STATUS_MOVABLE);
+    *(void ***)ptr = master;
+    *master = ptr + sizeof(void **);
+    tcb->handles++;
+
+    return master;
+}
+
+
+/******************************************************************************
+*
+*   Lock a handle so that it's block can't be moved, and return a pointer to
+*   the data.  Return NULL if the handle is not valid.
+*
+*/
+void *handle_lock(HANDLE handle) {
+
+    UCHAR *ptr;
+
+    if((ptr = handle_block(handle)) == NULL)
+        return NULL;
+
+    SETFLAG(HEAP_PTR_TO_HCB(ptr)->size, HEAP_STATUS_LOCKED);
+    return *handle;
+}
+
+
+/******************************************************************************
+*
+*   Let the block of a handle be moved again.
+*
+*/
+int handle_unlock(HANDLE handle) {
+
+    UCHAR *ptr;
+    HCB *hcb;
+    TCB *tcb;
+
+    if((ptr = handle_block(handle)) == NULL)
+        return TASK_ERROR;
+
+    hcb = HEAP_PTR_TO_HCB(ptr);
+    CLEARFLAG(hcb->size, HEAP_STATUS_LOCKED);
+
+    /*  It can be moved down into a hole that it was holding open */
+    if(hcb->prev != 0 && !HCB_IS_USED(HCB_PREV(hcb)) &&
+                (tcb = get_current_task_tcb()) != NULL)
+        SETFLAG(tcb->flags, TASK_COMPACT);
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Free a handle and it's block.  The handle must belong to the current
+*   task.
+*
+*/
+int handle_free(HANDLE handle) {
+
+    TCB *tcb;
+    UCHAR *ptr;
+
+    if((tcb = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    if((ptr = handle_block(handle)) == NULL)
+        return TASK_ERROR;
+
+    if(tcb_free(tcb, ptr))
+        return TASK_ERROR;
+
+    *handle = tcb->handle_free;
+    tcb->handle_free = handle;
+    tcb->handles--;
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Free the master pointers of a task that is exiting.  The blocks that they
+*   point to go away with the task's heap.
+*
+*/
+void free_task_handles(TCB *tcb) {
+
+    void **chunk;
+
+    while((chunk = tcb->handle_chunks) != NULL) {
+        tcb->handle_chunks = *chunk;
+        global_free(chunk);
+    }
+    tcb->handle_free = NULL;
+    tcb->handles = 0;
+}
+
+
+/******************************************************************************
+*
+*   STATIC FUNCTIONS
+*
+*/
+/******************************************************************************
+*
+*   Get a free master pointer.  If there are none, then allocate another
+*   HANDLE_CHUNK of them.  The first word of a chunk links it to the next 
+*   one.
+*
+*/
+static void **get_master(TCB *tcb) {
+
+    void **master;
+    UINT idx;
+
+    if(tcb->handle_free == NULL) {
+        master = global_alloc(sizeof(void *) * (HANDLE_CHUNK + 1));
+        if(master == NULL)
+            return NULL;
+        *master = tcb->handle_chunks;
+        tcb->handle_chunks = master++;
+        for(idx = 0; idx < HANDLE_CHUNK; idx++) {
+            master[idx] = tcb->handle_free;
+            tcb->handle_free = &master[idx];
+        }
+    }
+
+    master = tcb->handle_free;
+    tcb->handle_free = *master;
+
+    return master;
+}
+
+
+/******************************************************************************
+*
+*   Return the start of the heap block of a handle, or NULL if the handle is
+*   not valid.  The block has to point back to the master pointer.
+*
+*/
+static void *handle_block(HANDLE handle) {
+
+    UCHAR *ptr;
+
+    if(handle == NULL || *handle == NULL)
+        return NULL;
+
+    ptr = (UCHAR *)*handle - sizeof(void **);
+    if(*(void ***)ptr != handle ||
+                !TESTFLAG(HEAP_PTR_TO_HCB(ptr)->size, HEAP_STATUS_MOVABLE))
+        return NULL;
+
+    return ptr;
+}
@@ -18,6 +18,18 @@
 #define X86
 #define LINUX
 #define STAND_ALONE
+*
+*   Define HEAP_CHECK_MAGIC to put a magic number and the offset of the block
+*   into every heap block header.  It makes heap_walk() and heap_verify_node()
+*   much better at finding corruption, at the cost of 8 more bytes per block.
+*
+#define HEAP_CHECK_MAGIC
+*
+*   Define HEAP_PROFILE to record the call site and size of every task heap
+*   allocation.  A summary of each task's allocations by call site is printed
+*   when the task exits, which shows what it leaked.  See task_heap_profile().
+*
+#define HEAP_PROFILE
 */
 
 #if defined(LINUX)
@@ -54,6 +66,44 @@
     is allocated by the task unless it sends or receives messages or uses 
     semaphores.  The default should add a K or two.  Original setting is 4K.*/
 #define DEFAULT_HEAP_SIZE   4096
+/* When a task's heap runs out, it grows by adding an extent from the global
+    heap that is at least this big.  The heap of a task never grows past the
+    task's heap limit, which starts out as the larger of the heap size given
+    to task_create() and DEFAULT_HEAP_LIMIT.  See task_set_heap_limit(). */
+#define HEAP_EXTENT_SIZE    4096
+#define DEFAULT_HEAP_LIMIT  (DEFAULT_HEAP_SIZE * 16)
+/* Most events that a task's event queue holds.  What happens to the events
+    that do not fit is up to the queue's policy.  See event_queue_limit(). */
+#define DEFAULT_EVENT_LIMIT 256
+/* Size of the memory that the global heap is made from.  Where there is an
+    environment, it can be changed at startup with SROS_MEMORY_SIZE.  See 
+    main() in task.c. */
+#ifndef SYSTEM_MEMORY_SIZE
+#define SYSTEM_MEMORY_SIZE  (2 * 1024 * 1024)
+#endif
+/* The global heap is split in two.  Blocks of BUDDY_MIN_SIZE bytes and
+    bigger, such as task heaps and their extents, come from a buddy system.
+    Smaller ones, such as TCBs and events, come from a first fit heap that 
+    is 1/GLOBAL_SMALL_DIVISOR of the system memory.  See buddy.c. */
+#define BUDDY_MIN_ORDER     10
+#define BUDDY_MIN_SIZE      (1 << BUDDY_MIN_ORDER)
+#define BUDDY_MAX_ORDER     31
+#define GLOBAL_SMALL_DIVISOR    8
+/* How the system memory is requested from the platform.  See 
+    sys_get_memory(). */
+#ifndef SYSTEM_MEMORY_FLAGS
+#define SYSTEM_MEMORY_FLAGS SYS_MEMORY_HUGE
+#endif
+/* Number of call sites that are tracked for each task when HEAP_PROFILE is
+    defined.  It has to be a power of 2. */
+#define HEAP_PROFILE_SITES  32
+/* Number of heap blocks that are checked each time the scheduler runs.  
+    All of the task heaps are checked a few blocks at a time, so a corrupt 
+    heap is found without stopping the system to walk it.  Set it to 0 to 
+    turn the check off.  See task_heap_check(). */
+#ifndef HEAP_VERIFY_NODES
+#define HEAP_VERIFY_NODES   8
+#endif
 /* This is the priority that the system will set the user's task_main() to
     be. */
 #define DEFAULT_TASK_PRIORITY   200
@@ -80,12 +130,41 @@
 #define TESTFLAG(v, f)      ((v)&(f))
 
 #define HEAP_MAGIC          0xABADFADE
-#define HEAP_STATUS_FREE    0x01
-#define HEAP_STATUS_USED    0x02
 #define HEAP_MIN_SIZE       1024
 #define HEAP_MIN_NODE_SIZE  24
-#define HEAP_PTR_TO_HCB(ptr)    ((HCB *)(((UINT)(ptr))-sizeof(HCB)))
-#define HEAP_HCB_TO_PTR(hcb)    ((void *)(((UINT)(hcb))+sizeof(HCB)))
+/* Every heap block is a multiple of this many bytes, which leaves the low bits
+    of the size in the HCB free to be used as flags. */
+#define HEAP_GRAIN          8
+#define HEAP_FLAG_MASK      (HEAP_GRAIN - 1)
+#define HEAP_STATUS_USED    0x01
+#define HEAP_STATUS_MOVABLE 0x02    /* belongs to a handle, see handle.c */
+#define HEAP_STATUS_LOCKED  0x04    /* handle is locked, so it can't move */
+#define HEAP_ROUND(n)       (((n) + HEAP_FLAG_MASK) & ~HEAP_FLAG_MASK)
+#define HEAP_PTR_TO_HCB(ptr)    ((HCB *)((UCHAR *)(ptr) - sizeof(HCB)))
+#define HEAP_HCB_TO_PTR(hcb)    ((void *)((UCHAR *)(hcb) + sizeof(HCB)))
+#define HCB_SIZE(hcb)       ((hcb)->size & ~HEAP_FLAG_MASK)
+#define HCB_IS_USED(hcb)    TESTFLAG((hcb)->size, HEAP_STATUS_USED)
+#define HCB_CAN_MOVE(hcb)   (((hcb)->size & HEAP_FLAG_MASK) == \
+                                (HEAP_STATUS_USED | HEAP_STATUS_MOVABLE))
+#define HCB_NEXT(hcb)       ((HCB *)((UCHAR *)(hcb) + HCB_SIZE(hcb)))
+#define HCB_PREV(hcb)       ((HCB *)((UCHAR *)(hcb) - (hcb)->prev))
+#define HEAP_FIRST_HCB(h)   ((HCB *)((UCHAR *)(h) + sizeof(HEAP)))
+#define HEAP_END(h)         ((UCHAR *)(h) + (h)->size)
+/* is a block in a heap.  The header is looked at, since a block with no data
+    at the end of a heap starts at HEAP_END(). */
+#define HEAP_HAS_BLOCK(h, ptr)  \
+    ((UCHAR *)HEAP_PTR_TO_HCB(ptr) >= (UCHAR *)HEAP_FIRST_HCB(h) && \
+     (UCHAR *)HEAP_PTR_TO_HCB(ptr) < HEAP_END(h))
+/* HEAP flags */
+#define HEAP_STALE          0x01    /* largest_free needs to be recalculated */
+#define HEAP_EXTENT         0x02    /* added to a task heap when it grew */
+#define HEAP_CORRUPT        0x04    /* heap_verify_step() found an error */
+#define HEAP_ORPHAN         0x08    /* it's task exited with blocks still lent */
+
+/* common alignments for task_alloc_aligned() and global_alloc_aligned() */
+#define HEAP_ALIGN_SIMD     32
+#define HEAP_ALIGN_CACHE    64
+#define HEAP_ALIGN_PAGE     4096
 
 /*  make sure the status can never be wrapped around past the maximum for the
     data type  */
@@ -109,6 +188,21 @@
 
 /* bit flags */
 #define WAIT_FOR_EVENT      0x01
+#define TASK_INIT_DONE      0x02    /* task_init_complete() was called */
+#define TASK_ALLOC_FAIL     0x04    /* and allocations are made to fail */
+#define TASK_COMPACT        0x08    /* heap has holes that handles can fill */
+#define WAIT_FOR_ANY        0x10    /* blocked in task_wait_any() */
+#define WAIT_FOR_ROOM       0x20    /* blocked on another task's full queue */
+#define WAIT_FOR_CHANNEL    0x40    /* blocked on a full or empty channel */
+
+/* number of master pointers that are allocated at once for handles */
+#define HANDLE_CHUNK        16
+
+/* what happens to allocations after task_init_complete() or 
+    system_init_complete() */
+#define ALLOC_ALLOW         0x00    /* nothing, back to the init phase */
+#define ALLOC_REPORT        0x01    /* they are counted and the first is kept */
+#define ALLOC_FAIL          0x02    /* they are counted and they fail */
 
 /*  Events */
 #define INVALID_EVENT           0x1000
@@ -118,10 +212,76 @@
 #define SEMAPHORE_EVENT         0x1004
 #define SIGNAL_EVENT            0x1005
 
+/* Free events are kept for reuse instead of going back to the global heap.
+    EVENT_PREALLOC of them are allocated when the system starts and at most
+    EVENT_CACHE_LIMIT are kept.  See event.c */
+#define EVENT_PREALLOC          16
+#define EVENT_CACHE_LIMIT       64
+
+/* slots in the ring that other threads and signal handlers put events in, 
+    see inject_event().  Must be a power of 2. */
+#define EVENT_INJECT_SIZE       64
+
+/* bytes of data that can be sent with an event, see post_event_data() */
+#define EVENT_DATA_SIZE         16
+
+/* type masks for wait_event_match().  An event matches if it's type has any
+    of the bits of the mask set, so the types that are waited for with a mask
+    have to be single bits, or classes of types that share a bit.  All of the
+    system events have 0x1000 set.  EVENT_MATCH_TYPE() makes a mask that only
+    matches one type exactly, for types that are small numbers, like the 
+    system events.  The type can't have the top bit set. */
+#define EVENT_MATCH_ANY         0xFFFFFFFF
+#define EVENT_MATCH_SYSTEM      0x1000
+#define EVENT_MATCH_EXACT       0x80000000
+#define EVENT_MATCH_TYPE(t)     (EVENT_MATCH_EXACT | (t))
+
+/* event flags */
+#define EVENT_STATIC            0x01    /* part of something, never free'd */
+#define EVENT_QUEUED            0x02    /* a static event that is in a queue */
+#define EVENT_COALESCED         0x04    /* later events are merged into it */
+
+/* what happens to an event that is sent to a full queue */
+#define EVENT_QUEUE_FAIL        0   /* the sender gets TASK_ERROR */
+#define EVENT_QUEUE_BLOCK       1   /* the sender waits until there is room */
+#define EVENT_QUEUE_DROP_NEWEST 2   /* the new event is dropped */
+#define EVENT_QUEUE_DROP_OLDEST 3   /* the oldest event in the queue is */
+
+/* priority bands of an event queue, see post_event_priority().  Events are
+    received from the lowest band that has any, in the order they were sent.
+    Must be no more than the bits in a UINT. */
+#define EVENT_BANDS             4
+#define EVENT_BAND_URGENT       0
+#define EVENT_BAND_HIGH         1
+#define EVENT_BAND_NORMAL       2   /* what post_event() uses */
+#define EVENT_BAND_LOW          3
+
+/* type and subtype pairs that a task can have coalesced, see event_coalesce */
+#define EVENT_COALESCE_KEYS     8
+
+/* kinds of sources that task_wait_any() can wait for.  See wait.c */
+#define WAIT_SOURCE_EVENT       1   /* an event that matches a type mask */
+#define WAIT_SOURCE_TIMER       2   /* a deadline from sys_time() */
+#define WAIT_SOURCE_FD          3   /* a file descriptor */
+#define WAIT_SOURCE_CHANNEL     4   /* a channel, see channel.c */
+
+/* what to wait for on a file descriptor, or on a channel: an item to
+    receive or room to send */
+#define WAIT_READ               0x01
+#define WAIT_WRITE              0x02
+
+/* most file descriptors that all of the waiting tasks can wait for.
+    task_wait_any() fails if there would be more. */
+#define WAIT_MAX_FDS            32
+
 /*  Return Codes */
 #define TASK_ERROR          0xFFFFFFFF
 #define TASK_SUCCESS        0x00000000
 
+/*  Flags for sys_get_memory() */
+#define SYS_MEMORY_HUGE     0x01    /* back it with huge pages if possable */
+#define SYS_MEMORY_LOCK     0x02    /* fault it in and lock it in RAM */
+
 /*  Miscalenous */
 #define TASK_DEFAULT_TCB    NULL
 #define TASK_STACK_MAGIC    0x5A
@@ -132,6 +292,8 @@
 /* message flag */
 #define MESSAGE_RECIPT_REQUEST  0x01
 #define MESSAGE_NO_RECIPT       0x00
+#define MESSAGE_COPIED          0x02    /* the data was copied into the */
+                                        /* receiver's heap */
 
 /******************************************************************************
 *   Types
@@ -140,7 +302,9 @@
 /* generic types */
 typedef unsigned int    UINT;
 typedef unsigned char   UCHAR;
+typedef unsigned long   UPTR;   /* an integer the same size as a pointer */
 typedef UINT (*TASK_ENTRY)(void *);
+typedef void **HANDLE;  /* pointer to a master pointer, see handle.c */
 typedef void (*SIG_FUNC)(void);
 #ifdef _USE_SETJMP_
 typedef jmp_buf TASK_CONTEXT;
@@ -148,33 +312,129 @@ typedef jmp_buf TASK_CONTEXT;
 typedef UINT TASK_CONTEXT[UINT_SIZEOF_CONTEXT];
 #endif
 
-/* basic heap allocation data structure */
+/* basic heap allocation data structure.  The data that is accessable to the
+    user starts right after it. */
 typedef struct __hcb__ {
+#ifdef HEAP_CHECK_MAGIC
     UINT magic;     /* used for error checking */
-    UCHAR status;   /* allocated/free flag */
-    UINT start;     /* index of the start of this data structure in the heap
-                        buffer */
-    UINT size;      /* size of this allocated or free chunk, incl the header */
-    UCHAR data[1];  /* first byte of data that is accessable to the user */
+    UINT start;     /* offset of this data structure from the start of the 
+                        heap */
+#endif
+    UINT size;      /* size of this allocated or free chunk, incl the header.
+                        The low bits are the HEAP_STATUS flags. */
+    UINT prev;      /* size of the chunk before this one, 0 for the first */
+#ifdef HEAP_PROFILE
+    UINT site;      /* call site table entry + 1, 0 if it is not tracked */
+    UINT request;   /* number of bytes that were asked for */
+#endif
 } HCB;
 
-/* basic heap data structure */
+/* basic heap data structure.  The first HCB starts right after it. */
 typedef struct __heap__ {
     UINT size;      /* total size of the heap */
-    UINT address;   /* statrting address of this data structure */
-    UCHAR data[1];  /* start of the memory to be managed */
+    UINT flags;     /* HEAP_ flags */
+    struct __heap__ *address;   /* starting address of this data structure */
+
+    /* statistics that are kept up to date by the allocator */
+    UINT used;          /* bytes in allocated blocks, incl the headers */
+    UINT high_water;    /* most bytes that were ever allocated at once */
+    UINT used_blocks;   /* number of allocated blocks */
+    UINT free_blocks;   /* number of free blocks */
+    UINT largest_free;  /* size of the largest free block, see HEAP_STALE */
+    UINT allocs;        /* number of successful allocations */
+    UINT frees;         /* number of successful frees */
+    UINT failures;      /* number of allocations that failed */
+
+    /* state of heap_verify_step() */
+    UINT verify;        /* offset of the next block to check, 0 to start */
+    UINT passes;        /* number of times the whole heap was checked */
+
+    struct __heap__ *next;  /* next extent of a task heap that has grown */
+    UINT lent;          /* blocks that other tasks own, see heap_lend() */
 } HEAP;
 
-typedef struct __mq__ {
-    UINT num_msgs;
-    struct __msg__ *first, *last;
-} MESSAGE_QUEUE;
+/* heap statistics returned by heap_get_stats() */
+typedef struct __hs__ {
+    UINT size;          /* total size of the heap */
+    UINT used;          /* bytes in allocated blocks, incl the headers */
+    UINT free;          /* bytes in free blocks, incl the headers */
+    UINT high_water;    /* most bytes that were ever allocated at once */
+    UINT used_blocks;   /* number of allocated blocks */
+    UINT free_blocks;   /* number of free blocks */
+    UINT largest_free;  /* size of the largest free block */
+    UINT allocs;        /* number of successful allocations */
+    UINT frees;         /* number of successful frees */
+    UINT failures;      /* number of allocations that failed */
+    UINT fragmentation; /* percent of the free memory that is not in the
+                            largest free block.  0 means not fragmented. */
+} HEAP_STATS;
+
+/* allocations from one call site and size class, see HEAP_PROFILE */
+typedef struct __hsite__ {
+    void *caller;       /* return address of the call to task_alloc() */
+    UINT size_class;    /* requests were up to 1 << size_class bytes */
+    UINT live;          /* blocks that are still allocated */
+    UINT live_bytes;    /* bytes that were asked for in them */
+    UINT peak;          /* most blocks that were allocated at once */
+    UINT peak_bytes;    /* most bytes that were allocated at once */
+    UINT allocs;        /* number of allocations */
+} HEAP_SITE;
+
+/* the first corrupt heap block found by the background heap check */
+typedef struct __hc__ {
+    UINT task_number;   /* serial number of the task that owns the heap */
+    UINT extent;        /* which extent of the heap, 0 is the first one */
+    UINT offset;        /* offset of the bad block from the start of it */
+    int error;          /* what was wrong with it, see heap_walk() */
+} HEAP_CHECK;
+
+/* allocations that were made after initialization was declared complete */
+typedef struct __ac__ {
+    UINT count;         /* how many there were */
+    UINT task_number;   /* the task that made the first one */
+    void *caller;       /* where it was called from */
+    UINT size;          /* and how much it asked for */
+} ALLOC_CHECK;
+
+/* fixed size object pool carved out of a task's heap */
+typedef struct __pool__ {
+    UINT obj_size;  /* size of each object, rounded up to the heap grain */
+    UINT count;     /* number of objects in the pool */
+    UINT num_free;  /* number of objects that are on the free list */
+    struct __tcb__ *owner;  /* task that the pool was allocated from */
+    void *free_list;    /* free objects, linked through their first word */
+    UCHAR *objects; /* the first object */
+} POOL;
+
+/* bump pointer region carved out of a task's heap */
+typedef struct __region__ {
+    UINT size;      /* number of bytes that can be allocated */
+    UINT used;      /* offset of the next byte to allocate */
+    UINT high_water;    /* most bytes that were ever used between resets */
+    struct __tcb__ *owner;  /* task that the region was allocated from */
+    UCHAR *base;    /* first byte that can be allocated */
+} REGION;
 
 typedef struct __eq__ {
     UINT num_events;
-    struct __ev__ *first, *last;
+    UINT bands;     /* bit for each band that has events */
+    struct __ev__ *first[EVENT_BANDS], *last[EVENT_BANDS];
+    UINT limit;     /* most events that it holds, 0 for no limit */
+    UINT policy;    /* what to do when it is full, see EVENT_QUEUE_FAIL */
+    UINT drops;     /* events that were dropped or refused */
+    UINT peak;      /* most events that it has held */
+    struct __tcb__ *senders;    /* tasks that are waiting for room */
 } EVENT_QUEUE;
 
+/* statistics of an event queue, see event_queue_stats() */
+typedef struct __eqs__ {
+    UINT depth;     /* events in the queue now */
+    UINT peak;
+    UINT drops;
+    UINT limit;
+    UINT policy;
+} EVENT_QUEUE_STATS;
+
 /* types */
 typedef struct __tcb__ {
     /* task housekeeping */
@@ -182,7 +442,11 @@ typedef struct __tcb__ {
     UINT *stack;
     UINT ssize;
     HEAP *heap;
-    UINT hsize;
+    UINT hsize;     /* current size of the heap, incl all extents */
+    UINT hlimit;    /* size that the heap is allowed to grow to */
+    UINT handles;   /* number of handles that are allocated, see handle.c */
+    void **handle_free; /* master pointers that are not in use */
+    void *handle_chunks;    /* blocks of master pointers, see handle.c */
     UCHAR priority;
     int status;    /* could be a (-) number */
     UCHAR flags;
@@ -192,11 +456,24 @@ typedef struct __tcb__ {
     TASK_ENTRY entry;
     void *arg;
     
-    /* event queue where events are placed by the event_task() */
+    /* event queue where events are placed for the task, see event.c */
     EVENT_QUEUE *event_queue;
+    UINT event_match;   /* type mask of the events that it is waiting for */
+    struct __sub__ *subscriptions;  /* topics that it subscribes to */
+    struct __ek__ *coalesce;    /* EVENT_COALESCE_KEYS events to coalesce */
+    struct __mq__ *message_queue;   /* messages for the task, see message.c */
+    struct __ch__ *channels;    /* channels that it receives from */
+    struct __ch__ *channel_wait;    /* channel that it is blocked on */
+    EVENT_QUEUE *room_wait;     /* full queue that it is waiting on */
+    struct __tcb__ *room_next;  /* next task waiting on that queue */
         
     /* pointers for scheduler lists */
     struct __tcb__ *tnext, *tprev;
+
+#ifdef HEAP_PROFILE
+    /* call site table with HEAP_PROFILE_SITES entries, from the global heap */
+    HEAP_SITE *profile;
+#endif
     
     /* pad it out to an even word boundry */
 } __attribute__ ((aligned(32), packed)) TCB;
@@ -211,8 +488,80 @@ typedef struct __ev__ {
     TCB *sender;
     TCB *destination;
     struct __ev__ *next;
+    UCHAR flags;
+    UCHAR band;     /* priority band, EVENT_BAND_NORMAL unless it is sent */
+                    /* with post_event_priority() */
+    UCHAR data[EVENT_DATA_SIZE];    /* copied in by post_event_data() */
 } __attribute__ ((aligned(32), packed)) EVENT;
 
+/* an event from outside of the tasker, see inject_event() */
+typedef struct __ei__ {
+    UINT seq;           /* which turn of the ring the slot is ready for */
+    TCB *destination;
+    UINT type;
+    UINT subtype;
+} EVENT_INJECT;
+
+/* events of one type and subtype that are merged, see event_coalesce() */
+typedef struct __ek__ {
+    UINT type;
+    UINT subtype;
+    UINT used;          /* non-zero if this key is in use */
+    EVENT *pending;     /* the event of this key that is in the queue */
+} EVENT_KEY;
+
+/* one event of a batch that is sent with post_events() */
+typedef struct __ep__ {
+    TCB *destination;   /* NULL means the current task */
+    UINT type;
+    UINT subtype;
+} EVENT_POST;
+
+/* one event of a batch that was received, see wait_events() */
+typedef struct __eb__ {
+    TCB *sender;
+    UINT type;
+    UINT subtype;
+    UCHAR data[EVENT_DATA_SIZE];
+} EVENT_INFO;
+
+/* something that was published to a topic, see topic.c */
+typedef struct __tr__ {
+    UINT refs;          /* subscribers that have not read it yet */
+    UINT subtype;
+    TCB *sender;
+    UCHAR data[EVENT_DATA_SIZE];
+    struct __tr__ *next;
+} TOPIC_RECORD;
+
+/* one task's subscription to a topic */
+typedef struct __sub__ {
+    struct __topic__ *topic;
+    TCB *tcb;
+    TOPIC_RECORD *unread;   /* the first record that it has not read */
+    EVENT notice;           /* queued for the task when there is something */
+    struct __sub__ *next;       /* next subscriber of the topic */
+    struct __sub__ *task_next;  /* next subscription of the task */
+} SUBSCRIPTION;
+
+typedef struct __topic__ {
+    UINT type;              /* event type of the notices */
+    UINT subscribers;
+    SUBSCRIPTION *first;
+    TOPIC_RECORD *first_record, *last_record;
+} TOPIC;
+
+/* one of the things that task_wait_any() waits for */
+typedef struct __ws__ {
+    UINT kind;      /* one of the WAIT_SOURCE_ kinds */
+    UINT mask;      /* event type mask, or WAIT_READ and WAIT_WRITE for a fd
+                        or a channel */
+    UINT deadline;  /* sys_time() when a timer is ready */
+    int fd;         /* file descriptor */
+    struct __ch__ *channel;     /* set to NULL if it is destroyed */
+    UINT ready;     /* set when the source is ready */
+} WAIT_SOURCE;
+
 /* section for message.c */
 typedef struct __msg__ {
     UCHAR msg_type; /* so the receiver can tell what the sender meant. */
@@ -225,6 +574,27 @@ typedef struct __msg__ {
     struct __msg__ *next;   /* pointer to the next message */
 } __attribute__ ((aligned(32), packed)) MESSAGE;
 
+typedef struct __mq__ {
+    UINT num_msgs;
+    struct __msg__ *first, *last;
+    struct __msg__ *held;   /* received and not free'd yet */
+    EVENT notice;   /* MESSAGE_ARRIVAL_EVENT, queued while there are any */
+} MESSAGE_QUEUE;
+
+/* a ring of fixed size slots from one task to another, see channel.c.  The
+    slots follow it in the same block of the consumer's heap. */
+typedef struct __ch__ {
+    UINT slot_size;
+    UINT slots;
+    UINT head;      /* next slot to fill */
+    UINT tail;      /* next slot to empty */
+    UINT count;     /* slots that are full */
+    struct __tcb__ *consumer;   /* the task that created it */
+    struct __tcb__ *waiting;    /* the task that is blocked on it, if any */
+    struct __ch__ *next;    /* next channel of the consumer */
+    UCHAR *ring;
+} CHANNEL;
+
 typedef struct __cl__ {
     int argc;
     char **argv;
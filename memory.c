@@ -23,46 +23,123 @@
 *   allocater to allocate free space is a settable parameter.  I am thinking 
 *   about 20 bytes is about right.  
 *   
-*   When a block is freed, the list is checked and all free blocks that are 
-*   consecutive and free are merged together.
+*   When a block is freed, it is merged with the free blocks on either side 
+*   of it.
 *
 *   When the first block is allocated,
 *       1.  the root block's size is adjusted to be the allocation size
 *       2.  the status is changed to show that it is allocated
 *       3.  another block header is created at the end of the allocated block
 *
-*     All memory block data structures have a "magic" number at the start to
-*   help detect if there was a problem with over-shooting the end of a memory
-*   block.
+*     The list is not kept with pointers.  Every block starts with a heap 
+*   control block (HCB) that holds the size of the block and the size of the 
+*   block in front of it.  Given a block, the next one is found by adding the
+*   size to it's address and the previous one by subtracting the previous
+*   size.  That makes it possible to merge a free'd block with the free blocks
+*   on both sides of it without walking the heap.
 *
-*    The heap is treated like an array of chars.  The next heap object is
-*   indexed into the array instead of given a pointer to it.
+*     Blocks are always a multiple of HEAP_GRAIN bytes, which keeps the data
+*   returned to the user aligned and leaves the low bits of the size free to 
+*   hold the allocated/free flag.  That way the header is only 8 bytes.
 *
-*   typedef struct _hn_ {
-*       UINT magic;     // magic number to detect over-runs
-*       UCHAR status;   // allocated/free flag
-*       UINT size;      // size of this heap block
-*       UINT start;     // index of the start of this structure
-*       UCHAR data[1];  // pointer returned to caller of alloc()
-*   } HEAP_NODE;
+*   typedef struct _hcb_ {
+*       UINT magic;     // magic number to detect over-runs (optional)
+*       UINT start;     // offset of the start of this structure (optional)
+*       UINT size;      // size of this heap block | HEAP_STATUS_USED
+*       UINT prev;      // size of the heap block before this one
+*       UINT site;      // call site table entry (HEAP_PROFILE)
+*       UINT request;   // size that was asked for (HEAP_PROFILE)
+*   } HCB;
 *
-*     Given the above data structure, a pointer to the next item in the heap is
-*   given by "&heap[start+size]".
+*     If HEAP_CHECK_MAGIC is defined, then every block also has a "magic" 
+*   number and the offset of the block from the start of the heap.  They are 
+*   used to help detect if there was a problem with over-shooting the end of
+*   a memory block.
+*
+*     The memory of the global heap is split between a first fit heap for
+*   small blocks and a buddy system for blocks of BUDDY_MIN_SIZE and bigger.
+*   Task heaps come and go as tasks are created and killed, and the buddy 
+*   system merges them back into big blocks in a few steps without leaving 
+*   holes between the small blocks.  See buddy.c.
+*
+*     The global heap can be used by more than one host thread, so it is 
+*   protected by a lock.  Small blocks, such as events, messages and topic
+*   records, are not allocated from it one at a time.  (A TCB is bigger than
+*   the biggest class, so it comes from the locked heap.)  Each thread keeps a cache of 
+*   free small blocks, sorted into size classes.  When a class runs dry, a 
+*   batch of blocks is allocated with the lock held once, and when a class 
+*   has too many blocks, a batch of them is free'd the same way.  Blocks in 
+*   a cache are still allocated as far as the global heap is concerned.
 *
 \*****************************************************************************/
 #include "kern.h"
 
+/*  Size classes of the thread caches.  Class "n" holds blocks with at least
+    (n + 1) * CACHE_STEP bytes of data, not counting the header.  A free block
+    in a cache is linked through it's data, so CACHE_STEP must be at least
+    the size of a pointer.  */
+#define CACHE_STEP      16
+#define CACHE_CLASSES   16
+/*  Number of blocks that are moved between a cache and the global heap at
+    once, and the most blocks that one class of a cache keeps.  */
+#define CACHE_BATCH     8
+#define CACHE_LIMIT     32
+
+typedef struct {
+    void *list[CACHE_CLASSES];  /* free blocks linked through the first word */
+    UINT count[CACHE_CLASSES];
+} THREAD_CACHE;
+
 static HEAP *global_heap;
+static SYS_LOCK global_lock = SYS_LOCK_INITIALIZER;
+static SYS_THREAD_LOCAL THREAD_CACHE thread_cache;
 
 static int verify_node(HEAP *h, HCB *hcb);
+static inline void set_node(HEAP *h, HCB *hcb, UINT size, UINT prev);
+static UINT largest_free_block(HEAP *h);
 static void inline clear_memory(void *ptr, UINT size);
-static void *heap_alloc(HEAP *h, UINT size);
+static void *heap_alloc(HEAP *h, UINT size, UINT align);
+static void *extent_alloc(HEAP *h, UINT size, UINT align);
+static void *task_heap_alloc(TCB *tcb, UINT size, UINT align, void *caller);
+static int task_heap_free(TCB *tcb, void *ptr);
+static void *cache_refill(UINT cls);
+static void cache_flush(UINT cls, UINT keep);
+static HEAP *grow_task_heap(TCB *tcb, UINT size, UINT align);
+static UINT align_padding(HCB *hcb, UINT align);
 static void *heap_realloc(HEAP *h, void *ptr, UINT size);
 static int heap_free(HEAP *h, void *ptr);
+static void *large_alloc(UINT size, UINT align);
+static void set_fragmentation(HEAP_STATS *stats);
+static int alloc_allowed(UINT size, void *caller);
+static UINT compact_extent(HEAP *h);
+static HCB *slide_block(HEAP *h, HCB *hcb);
+
+/*  The call site that an allocation is charged to by HEAP_PROFILE and by the
+    steady state check.  */
+#define CALLER  __builtin_return_address(0)
+
+/*  Allocation policy after system_init_complete(), and what was caught */
+static UINT system_policy = ALLOC_ALLOW;
+static ALLOC_CHECK alloc_check = {0, 0, NULL, 0};
+
+/*  Private functions defined in profile.c */
+#ifdef HEAP_PROFILE
+extern void profile_alloc(TCB *tcb, void *ptr, UINT size, void *caller);
+extern void profile_free(TCB *tcb, void *ptr);
+#endif
+
+/*  Private functions defined in buddy.c */
+extern UINT buddy_init(UCHAR *start, UINT size);
+extern int buddy_contains(void *ptr);
+extern void *buddy_alloc(UINT size, UINT align);
+extern int buddy_free(void *ptr);
+extern void buddy_stats(HEAP_STATS *stats);
 
 /******************************************************************************
 *
-*   Initialize the global heap.
+*   Initialize the global heap.  The small block heap is made from the 
+*   front of the memory and the buddy system from the rest.  If there is not
+*   enough memory to be worth splitting, then it is all one heap.
 *   
 */
 int init_global_heap(UCHAR *start, UINT size) {
@@ -71,7 +148,20 @@ int init_global_heap(UCHAR *start, UINT size) {
         be known in advance.  Therefore, this call should never really fail.
         The logic to catch a failure is here to aid in development only.  
         See main() in the file task.c to see how this funciton is used.  */
-    if((global_heap = init_heap(start, size)) != NULL) 
+    UINT skip, small;
+
+    /*  Heaps have to start on a grain boundry.  */
+    skip = (HEAP_GRAIN - ((UPTR)start & HEAP_FLAG_MASK)) & HEAP_FLAG_MASK;
+    if(size < skip)
+        return TASK_ERROR;
+    start += skip;
+    size -= skip;
+
+    small = HEAP_ROUND(size / GLOBAL_SMALL_DIVISOR);
+    if(small < HEAP_MIN_SIZE || buddy_init(start + small, size - small) == 0)
+        small = size;
+
+    if((global_heap = init_heap(start, small)) != NULL) 
         return TASK_SUCCESS;
     else
         return TASK_ERROR;
@@ -85,7 +175,8 @@ int init_global_heap(UCHAR *start, UINT size) {
 *   to gain access to the first HCB.
 *
 *   If this function is successful, then return a pointer to the first heap
-*   control block.  If it fails, then return NULL.
+*   control block.  If it fails, then return NULL.  The start has to be 
+*   aligned to HEAP_GRAIN, which memory from another heap always is.
 *
 */
 HEAP *init_heap(UCHAR *start, UINT size) {
@@ -98,19 +189,19 @@ HEAP *init_heap(UCHAR *start, UINT size) {
         return NULL;
 
     /*  Is the caller sane??? */
-    if(size < HEAP_MIN_SIZE)
+    if(size < HEAP_MIN_SIZE || ((UPTR)start & HEAP_FLAG_MASK) != 0)
         return NULL;
 
     /* init the heap control block */
-    heap->size = size;
-    heap->address = (UINT)start;
-    hcb = (HCB *)(start + sizeof(HEAP));
+    clear_memory(heap, sizeof(HEAP));
+    heap->size = size & ~HEAP_FLAG_MASK;
+    heap->address = heap;
+    hcb = HEAP_FIRST_HCB(heap);
 
     /* init the first heap node */
-    hcb->size = size - sizeof(HEAP);
-    hcb->start = sizeof(HEAP);
-    hcb->magic = HEAP_MAGIC;
-    hcb->status = HEAP_STATUS_FREE;
+    set_node(heap, hcb, heap->size - sizeof(HEAP), 0);
+    heap->free_blocks = 1;
+    heap->largest_free = HCB_SIZE(hcb);
 
     /*  Return a pointer to the new heap.  */
     return heap;
@@ -123,6 +214,46 @@ HEAP *init_heap(UCHAR *start, UINT size) {
 *   pointer to be local to this module.
 *
 */
+/******************************************************************************
+*
+*   Allocate memory from the global heap for the system itself, such as for
+*   an event that comes from outside of the tasks.  It is not for the current
+*   task, so it is not checked or counted by alloc_allowed().
+*
+*/
+void *global_alloc_system(UINT size) {
+
+    THREAD_CACHE *tc = &thread_cache;
+    UINT cls;
+    void *ptr;
+
+    if(size >= BUDDY_MIN_SIZE)
+        return large_alloc(size, 1);
+
+    if(size > CACHE_STEP * CACHE_CLASSES) {
+        /* too big for the caches */
+        sys_lock(&global_lock);
+        ptr = heap_alloc(global_heap, size, 1);
+        sys_unlock(&global_lock);
+        return ptr;
+    }
+
+    /*  Even an empty block has to hold the free list link */
+    if(size < sizeof(void *))
+        size = sizeof(void *);
+    cls = (size - 1) / CACHE_STEP;
+    if((ptr = tc->list[cls]) != NULL) {
+        tc->list[cls] = *(void **)ptr;
+        tc->count[cls]--;
+    }
+    else if((ptr = cache_refill(cls)) == NULL)
+        return NULL;
+
+    clear_memory(ptr, size);
+    return ptr;
+}
+
+
 /******************************************************************************
 *
 *   Allocate memory from the global heap.
@@ -130,7 +261,33 @@ HEAP *init_heap(UCHAR *start, UINT size) {
 */
 void *global_alloc(UINT size) {
 
-    return heap_alloc(global_heap, size);
+    if(!alloc_allowed(size, CALLER))
+        return NULL;
+
+    return global_alloc_system(size);
+}
+
+
+/******************************************************************************
+*
+*   Allocate aligned memory from the global heap.
+*
+*/
+void *global_alloc_aligned(UINT size, UINT align) {
+
+    void *ptr;
+
+    if(!alloc_allowed(size, CALLER))
+        return NULL;
+
+    if(size >= BUDDY_MIN_SIZE)
+        return large_alloc(size, align);
+
+    sys_lock(&global_lock);
+    ptr = heap_alloc(global_heap, size, align);
+    sys_unlock(&global_lock);
+
+    return ptr;
 }
 
 
@@ -141,7 +298,13 @@ void *global_alloc(UINT size) {
 */
 void *global_realloc(void *ptr, UINT size) {
 
-    return heap_realloc(global_heap, ptr, size);
+    void *nptr;
+
+    sys_lock(&global_lock);
+    nptr = heap_realloc(global_heap, ptr, size);
+    sys_unlock(&global_lock);
+
+    return nptr;
 }
 
 
@@ -152,7 +315,53 @@ void *global_realloc(void *ptr, UINT size) {
 */
 int global_free(void *ptr) {
 
-    return heap_free(global_heap, ptr);
+    THREAD_CACHE *tc = &thread_cache;
+    UINT size;
+    int retv;
+
+    if(buddy_contains(ptr)) {
+        sys_lock(&global_lock);
+        retv = buddy_free(ptr);
+        sys_unlock(&global_lock);
+        return retv;
+    }
+
+    /*  The block belongs to the caller, so the header can be looked at 
+        without the lock.  */
+    if(heap_verify_node(global_heap, ptr))
+        return 1;
+
+    size = HCB_SIZE(HEAP_PTR_TO_HCB(ptr)) - sizeof(HCB);
+    if(size < CACHE_STEP || size > CACHE_STEP * CACHE_CLASSES) {
+        sys_lock(&global_lock);
+        retv = heap_free(global_heap, ptr);
+        sys_unlock(&global_lock);
+        return retv;
+    }
+
+    /*  Put it in the biggest class that it is big enough for. */
+    size = size / CACHE_STEP - 1;
+    *(void **)ptr = tc->list[size];
+    tc->list[size] = ptr;
+    if(++tc->count[size] > CACHE_LIMIT)
+        cache_flush(size, CACHE_LIMIT - CACHE_BATCH);
+
+    return 0;
+}
+
+
+/******************************************************************************
+*
+*   Give all of the blocks in the calling thread's cache back to the global 
+*   heap.  A host thread should call this before it exits.
+*
+*/
+void global_cache_flush(void) {
+
+    UINT cls;
+
+    for(cls = 0; cls < CACHE_CLASSES; cls++)
+        cache_flush(cls, 0);
 }
 
 
@@ -166,7 +375,21 @@ void *task_alloc(UINT size) {
     TCB *tcb;
     
     tcb = get_current_task_tcb();
-    return heap_alloc(tcb->heap, size);
+    return task_heap_alloc(tcb, size, 1, CALLER);
+}
+
+
+/******************************************************************************
+*
+*   Allocate aligned memory from the current task's heap.
+*
+*/
+void *task_alloc_aligned(UINT size, UINT align) {
+
+    TCB *tcb;
+    
+    tcb = get_current_task_tcb();
+    return task_heap_alloc(tcb, size, align, CALLER);
 }
 
 
@@ -194,7 +417,7 @@ int task_free(void *ptr) {
     TCB *tcb;
     
     tcb = get_current_task_tcb();
-    return heap_free(tcb->heap, ptr);
+    return task_heap_free(tcb, ptr);
 }
 
 
@@ -205,7 +428,7 @@ int task_free(void *ptr) {
 */
 void *tcb_alloc(TCB *tcb, UINT size) {
 
-    return heap_alloc(tcb->heap, size);
+    return task_heap_alloc(tcb, size, 1, CALLER);
 }
 
 
@@ -227,7 +450,312 @@ void *tcb_realloc(TCB *tcb, void *ptr, UINT size) {
 */
 int tcb_free(TCB *tcb, void *ptr) {
 
-    return heap_free(tcb->heap, ptr);
+    return task_heap_free(tcb, ptr);
+}
+
+
+/******************************************************************************
+*
+*   Set the size that a task's heap is allowed to grow to.  A NULL TCB means
+*   the current task.  Setting the limit to the size that the heap already is
+*   stops it from growing.  Extents that the heap already has are kept until
+*   they are empty.
+*
+*/
+int task_set_heap_limit(TCB *tcb, UINT limit) {
+
+    if(tcb == NULL) {
+        if((tcb = get_current_task_tcb()) == NULL)
+            return TASK_ERROR;
+    }
+
+    tcb->hlimit = limit;
+    return TASK_SUCCESS;
+}
+
+/******************************************************************************
+*
+*   Declare that the current task is done initializing.  From now on, every
+*   allocation that the task makes from it's own heap or the global heap is
+*   counted, and with ALLOC_FAIL it also fails.  ALLOC_ALLOW puts the task 
+*   back in it's init phase.
+*
+*/
+int task_init_complete(UINT policy) {
+
+    TCB *tcb;
+
+    if((tcb = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    CLEARFLAG(tcb->flags, TASK_INIT_DONE | TASK_ALLOC_FAIL);
+    if(policy != ALLOC_ALLOW)
+        SETFLAG(tcb->flags, TASK_INIT_DONE);
+    if(TESTFLAG(policy, ALLOC_FAIL))
+        SETFLAG(tcb->flags, TASK_ALLOC_FAIL);
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Declare that the whole system is done initializing.  This is the same as
+*   task_init_complete() for every task, including the allocations that the 
+*   kernel makes for them, such as events.
+*
+*/
+void system_init_complete(UINT policy) {
+
+    system_policy = policy;
+}
+
+
+/******************************************************************************
+*
+*   Get the allocations that were made after initialization was declared 
+*   complete.  Return TASK_ERROR if there were any, and TASK_SUCCESS if not.
+*
+*/
+int alloc_check_report(ALLOC_CHECK *report) {
+
+    int retv;
+
+    sys_lock(&global_lock);
+    if(report != NULL)
+        *report = alloc_check;
+    retv = (alloc_check.count == 0)? TASK_SUCCESS: TASK_ERROR;
+    sys_unlock(&global_lock);
+
+    return retv;
+}
+
+
+/******************************************************************************
+*
+*   Give all of the memory of a task's heap back to the global heap, 
+*   including the extents that it grew.  Used when a task is destroyed.
+*   An extent that has blocks lent to other tasks is kept until they are all
+*   given back, see heap_return().
+*
+*/
+void free_task_heap(TCB *tcb) {
+
+    HEAP *h, *next;
+
+    for(h = tcb->heap; h != NULL; h = next) {
+        next = h->next;
+        if(h->lent != 0) {
+            h->next = NULL;
+            SETFLAG(h->flags, HEAP_ORPHAN);
+        }
+        else
+            global_free(h);
+    }
+
+    tcb->heap = NULL;
+    tcb->hsize = 0;
+}
+
+
+/******************************************************************************
+*
+*   Lend a block of a task's heap to another task, so that it can be handed
+*   over without copying it.  The block stays where it is, and it is free'd 
+*   with heap_return() by whichever task is done with it.  The block has to
+*   be in use and hold at least "size" bytes.  Blocks that belong to handles
+*   can move, so they can't be lent.  So that this costs the same for any
+*   block, the heap is not walked.  Instead the blocks on both sides have to
+*   agree about where this one starts and ends, which a pointer into the
+*   middle of a block, such as into the stack, almost never passes.  With
+*   HEAP_CHECK_MAGIC, the magic number has to match too.  Return the extent
+*   that the block is in, or NULL if it can't be lent.
+*
+*/
+HEAP *heap_lend(TCB *tcb, void *ptr, UINT size) {
+
+    HEAP *h;
+    HCB *hcb, *next, *prev;
+
+    for(h = tcb->heap; h != NULL; h = h->next) {
+        if(HEAP_HAS_BLOCK(h, ptr))
+            break;
+    }
+
+    if(h == NULL || heap_verify_node(h, ptr))
+        return NULL;
+
+    hcb = HEAP_PTR_TO_HCB(ptr);
+    if(TESTFLAG(hcb->size, HEAP_STATUS_MOVABLE) ||
+                HCB_SIZE(hcb) - sizeof(HCB) < size)
+        return NULL;
+
+    /*  heap_verify_node() made sure that the next block is in the heap */
+    next = HCB_NEXT(hcb);
+    if((UCHAR *)next < HEAP_END(h) && next->prev != HCB_SIZE(hcb))
+        return NULL;
+
+    if(hcb->prev == 0) {
+        if(hcb != HEAP_FIRST_HCB(h))
+            return NULL;
+    }
+    else {
+        prev = HCB_PREV(hcb);
+        if((UCHAR *)prev < (UCHAR *)HEAP_FIRST_HCB(h) || 
+                    (UCHAR *)prev > (UCHAR *)hcb ||
+                    HCB_SIZE(prev) != hcb->prev)
+            return NULL;
+    }
+
+    h->lent++;
+
+    return h;
+}
+
+
+/******************************************************************************
+*
+*   Free a block that was lent with heap_lend().  "h" is the extent that 
+*   it is in, and "tcb" is the task that lent it.  If the task has exited, 
+*   then the extent is free'd along with the last block that was lent from 
+*   it, and the task is not touched.
+*
+*/
+int heap_return(HEAP *h, TCB *tcb, void *ptr) {
+
+    if(h == NULL || h->lent == 0)
+        return TASK_ERROR;
+
+    h->lent--;
+    if(TESTFLAG(h->flags, HEAP_ORPHAN)) {
+        if(h->lent == 0)
+            global_free(h);
+        return TASK_SUCCESS;
+    }
+
+    return (task_heap_free(tcb, ptr))? TASK_ERROR: TASK_SUCCESS;
+}
+
+/******************************************************************************
+*
+*   Compact a task's heap.  In each extent, the blocks that belong to handles
+*   that are not locked are slid down into the free space in front of them,
+*   so the free space is gathered into one block in front of the next block
+*   that can't move.  The master pointers of the handles are updated.  
+*
+*   Return the number of blocks that were moved.
+*
+*/
+UINT task_heap_compact(TCB *tcb) {
+
+    HEAP *h;
+    UINT moved = 0;
+
+    if(tcb == NULL && (tcb = get_current_task_tcb()) == NULL)
+        return 0;
+
+    for(h = tcb->heap; h != NULL; h = h->next)
+        moved += compact_extent(h);
+    CLEARFLAG(tcb->flags, TASK_COMPACT);
+
+    return moved;
+}
+
+
+/******************************************************************************
+*
+*   Fill in the statistics of a heap.  All of the counters are kept up to 
+*   date as blocks are allocated and free'd, so this does not walk the heap
+*   unless the largest free block was allocated from since the last call.
+*
+*/
+int heap_get_stats(HEAP *h, HEAP_STATS *stats) {
+
+    if(h == NULL || stats == NULL || h != h->address)
+        return TASK_ERROR;
+
+    if(TESTFLAG(h->flags, HEAP_STALE)) {
+        h->largest_free = largest_free_block(h);
+        CLEARFLAG(h->flags, HEAP_STALE);
+    }
+
+    stats->size = h->size;
+    stats->used = h->used;
+    stats->free = h->size - sizeof(HEAP) - h->used;
+    stats->high_water = h->high_water;
+    stats->used_blocks = h->used_blocks;
+    stats->free_blocks = h->free_blocks;
+    stats->largest_free = h->largest_free;
+    stats->allocs = h->allocs;
+    stats->frees = h->frees;
+    stats->failures = h->failures;
+
+    set_fragmentation(stats);
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Get the statistics of the global heap.  They are for the small block heap
+*   and the buddy system together.  Blocks that are in the thread caches 
+*   count as used.
+*
+*/
+int global_heap_stats(HEAP_STATS *stats) {
+
+    int retv;
+
+    sys_lock(&global_lock);
+    if((retv = heap_get_stats(global_heap, stats)) == TASK_SUCCESS) {
+        buddy_stats(stats);
+        set_fragmentation(stats);
+    }
+    sys_unlock(&global_lock);
+
+    return retv;
+}
+
+
+/******************************************************************************
+*
+*   Get the statistics of a task's heap.  A NULL TCB means the current task.
+*   If the heap has grown, then the statistics are for all of the extents.
+*
+*/
+int task_heap_stats(TCB *tcb, HEAP_STATS *stats) {
+
+    HEAP_STATS ext;
+    HEAP *h;
+
+    if(tcb == NULL) {
+        if((tcb = get_current_task_tcb()) == NULL)
+            return TASK_ERROR;
+    }
+
+    if(heap_get_stats(tcb->heap, stats) != TASK_SUCCESS)
+        return TASK_ERROR;
+
+    /*  Add in the extents that the heap has grown.  The high water mark in
+        the first heap is kept for the whole task.  */
+    for(h = tcb->heap->next; h != NULL; h = h->next) {
+        if(heap_get_stats(h, &ext) != TASK_SUCCESS)
+            return TASK_ERROR;
+        stats->size += ext.size;
+        stats->used += ext.used;
+        stats->free += ext.free;
+        stats->used_blocks += ext.used_blocks;
+        stats->free_blocks += ext.free_blocks;
+        stats->allocs += ext.allocs;
+        stats->frees += ext.frees;
+        if(ext.largest_free > stats->largest_free)
+            stats->largest_free = ext.largest_free;
+    }
+
+    set_fragmentation(stats);
+
+    return TASK_SUCCESS;
 }
 
 
@@ -240,9 +768,9 @@ int tcb_free(TCB *tcb, void *ptr) {
 */
 int heap_walk(HEAP *h) {
 
-    UINT max_addr;
     HCB *hcb;
     HEAP *heap;
+    UINT prev = 0;
 
     /* do some sanity checking */
     if((heap = h) == NULL)
@@ -251,20 +779,122 @@ int heap_walk(HEAP *h) {
     if(heap->size < HEAP_MIN_SIZE)
         return 2;
 
-    if((UINT)heap != (UINT)heap->address)
+    if(heap != heap->address)
         return 3;
 
-    /* calculate the highest address that is in the heap */
-    max_addr = (UINT)heap + heap->size;
-    for(hcb = (HCB *)((UINT)heap + sizeof(HEAP));
-                (UINT)hcb < max_addr;
-                (UINT)hcb += hcb->size) {
+    for(hcb = HEAP_FIRST_HCB(heap);
+                (UCHAR *)hcb < HEAP_END(heap);
+                hcb = HCB_NEXT(hcb)) {
 
         /* check the node */
         if(verify_node(heap, hcb))
             return 4;
+
+        /* check the link back to the previous node */
+        if(hcb->prev != prev)
+            return 5;
+
+        /* two free blocks in a row should have been merged */
+        if(prev != 0 && !HCB_IS_USED(hcb) && !HCB_IS_USED(HCB_PREV(hcb)))
+            return 6;
+
+        prev = HCB_SIZE(hcb);
+    }
+
+    /* the last block has to end exactly at the end of the heap */
+    if((UCHAR *)hcb != HEAP_END(heap))
+        return 7;
+
+    return 0;
+}
+
+
+/******************************************************************************
+*
+*   Check up to "count" blocks of a heap, starting where the last call left
+*   off.  This does the same checks as heap_walk(), a few blocks at a time, 
+*   so that it can be done while the system is running.  When the end of the
+*   heap is reached, h->passes is incremented and the next call starts over.
+*
+*   Return 0 if nothing is wrong, or the same error code as heap_walk() with
+*   the offset of the bad block from the start of the heap in "offset".  A
+*   heap with an error is marked HEAP_CORRUPT.
+*
+*/
+int heap_verify_step(HEAP *h, UINT count, UINT *offset) {
+
+    HCB *hcb, *phcb, *nhcb;
+    int retv = 0;
+
+    /* do some sanity checking */
+    if(h == NULL)
+        return 1;
+
+    if(h->size < HEAP_MIN_SIZE)
+        return 2;
+
+    if(h != h->address)
+        return 3;
+
+    if(h->verify == 0)
+        h->verify = sizeof(HEAP);
+    hcb = (HCB *)((UCHAR *)h + h->verify);
+
+    for(; count > 0; count--) {
+
+        /* start over when the end is reached */
+        if((UCHAR *)hcb >= HEAP_END(h)) {
+            h->verify = 0;
+            h->passes++;
+            return 0;
+        }
+
+        /* check the node */
+        if(verify_node(h, hcb)) {
+            retv = 4;
+            break;
+        }
+
+        /* the block before this one has to end where this one starts */
+        if(hcb->prev != 0) {
+            phcb = HCB_PREV(hcb);
+            if((UCHAR *)phcb < (UCHAR *)HEAP_FIRST_HCB(h) || 
+                        HCB_SIZE(phcb) != hcb->prev) {
+                retv = 5;
+                break;
+            }
+
+            /* two free blocks in a row should have been merged */
+            if(!HCB_IS_USED(hcb) && !HCB_IS_USED(phcb)) {
+                retv = 6;
+                break;
+            }
+        }
+        else if(hcb != HEAP_FIRST_HCB(h)) {
+            retv = 5;
+            break;
+        }
+
+        /* and the block after it has to agree on the size, so that a bad
+            size is blamed on this block and not the one after it */
+        nhcb = HCB_NEXT(hcb);
+        if((UCHAR *)nhcb < HEAP_END(h) && nhcb->prev != HCB_SIZE(hcb)) {
+            retv = 5;
+            break;
+        }
+
+        hcb = nhcb;
     }
 
+    if(retv != 0) {
+        if(offset != NULL)
+            *offset = (UINT)((UCHAR *)hcb - (UCHAR *)h);
+        SETFLAG(h->flags, HEAP_CORRUPT);
+        h->verify = 0;
+        return retv;
+    }
+
+    h->verify = (UINT)((UCHAR *)hcb - (UCHAR *)h);
     return 0;
 }
 
@@ -272,14 +902,27 @@ int heap_walk(HEAP *h) {
 /******************************************************************************
 *
 *   Verify that the node that was allocated is actually a part of the
-*   specified heap.  If the magic number matches the system magic number and
-*   the ((start index + address of the heap) == the address of the heap node)
-*   then the node is valid.  Otherwise it is not.  If the node is not valid,
-*   then return a non-zero error code.  Otherwise return zero.
+*   specified heap.  If the node lies inside of the heap, is allocated, and 
+*   it's size fits in the heap, then the node is valid.  Otherwise it is not.
+*   If the node is not valid, then return a non-zero error code.  Otherwise 
+*   return zero.
 */
 int heap_verify_node(HEAP *h, void *node) {
 
-    return verify_node(h, HEAP_PTR_TO_HCB(node));
+    HCB *hcb;
+
+    if(h == NULL || node == NULL)
+        return 1;
+
+    hcb = HEAP_PTR_TO_HCB(node);
+    if((UCHAR *)hcb < (UCHAR *)HEAP_FIRST_HCB(h) || 
+                (UCHAR *)hcb >= HEAP_END(h))
+        return 1;
+
+    if(!HCB_IS_USED(hcb))
+        return 2;
+
+    return verify_node(h, hcb);
 }
 
 
@@ -287,44 +930,301 @@ int heap_verify_node(HEAP *h, void *node) {
 *
 *   Static functions
 */
+/******************************************************************************
+*
+*   Allocate a batch of blocks for a class of the thread cache with the lock 
+*   held only once.  Return one of them and keep the rest in the cache.  If 
+*   the global heap cannot give any, then return NULL.
+*/
+static void *cache_refill(UINT cls) {
+
+    THREAD_CACHE *tc = &thread_cache;
+    UINT size, idx;
+    void *ptr, *first;
+
+    /*  Allocate the whole class size so that any block in the class fits
+        any request for the class.  */
+    size = (cls + 1) * CACHE_STEP;
+
+    sys_lock(&global_lock);
+    first = heap_alloc(global_heap, size, 1);
+    for(idx = 1; first != NULL && idx < CACHE_BATCH; idx++) {
+        if((ptr = extent_alloc(global_heap, size, 1)) == NULL)
+            break;
+        *(void **)ptr = tc->list[cls];
+        tc->list[cls] = ptr;
+        tc->count[cls]++;
+    }
+    sys_unlock(&global_lock);
+
+    return first;
+}
+
+
+/******************************************************************************
+*
+*   Free blocks from a class of the thread cache back to the global heap, 
+*   with the lock held only once, until only "keep" are left.
+*/
+static void cache_flush(UINT cls, UINT keep) {
+
+    THREAD_CACHE *tc = &thread_cache;
+    void *ptr;
+
+    if(tc->count[cls] <= keep)
+        return;
+
+    sys_lock(&global_lock);
+    while(tc->count[cls] > keep) {
+        ptr = tc->list[cls];
+        tc->list[cls] = *(void **)ptr;
+        tc->count[cls]--;
+        heap_free(global_heap, ptr);
+    }
+    sys_unlock(&global_lock);
+}
+
+
 /******************************************************************************
 *
 *   Allocate memory from the heap control block and return a pointer to it.
 *   The HCB parameter is the first heap node.  If there is no room, then
 *   return NULL.
+*
+*   The pointer returned is a multiple of "align", which must be a power of 
+*   two.  A free block whose data area is not aligned can still be used if
+*   it is large enough to have the padding split off of the front of it as a 
+*   free block of it's own.  That way the padding is merged back into the 
+*   heap by heap_free() like any other free block.
+*
+*   Allocations that fail are counted in the heap's statistics.
+*/
+static void *heap_alloc(HEAP *h, UINT size, UINT align) {
+
+    void *ptr;
+
+    if((ptr = extent_alloc(h, size, align)) == NULL && h != NULL)
+        h->failures++;
+
+    return ptr;
+}
+
+
+/******************************************************************************
+*
+*   Allocate memory from a task's heap.  If none of the extents that the heap
+*   already has can hold it, then the heap grows by a new extent from the 
+*   global heap, as long as that stays under the task's heap limit.  The 
+*   caller is the call site that the allocation is charged to by HEAP_PROFILE.
+*/
+static void *task_heap_alloc(TCB *tcb, UINT size, UINT align, void *caller) {
+
+    HEAP *h;
+    UINT used = 0;
+    void *ptr = NULL;
+
+    if(!alloc_allowed(size, caller))
+        return NULL;
+
+    for(h = tcb->heap; h != NULL && ptr == NULL; h = h->next)
+        ptr = extent_alloc(h, size, align);
+
+    /*  If the task has handles, then moving them might make enough room. */
+    if(ptr == NULL && tcb->handles != 0 && task_heap_compact(tcb) != 0) {
+        for(h = tcb->heap; h != NULL && ptr == NULL; h = h->next)
+            ptr = extent_alloc(h, size, align);
+    }
+
+    if(ptr == NULL) {
+        if((h = grow_task_heap(tcb, size, align)) != NULL)
+            ptr = extent_alloc(h, size, align);
+        if(ptr == NULL) {
+            tcb->heap->failures++;
+            return NULL;
+        }
+    }
+
+    /*  Keep the high water mark of the whole task in the first heap.  */
+    if(tcb->heap->next != NULL) {
+        for(h = tcb->heap; h != NULL; h = h->next)
+            used += h->used;
+        if(used > tcb->heap->high_water)
+            tcb->heap->high_water = used;
+    }
+
+#ifdef HEAP_PROFILE
+    profile_alloc(tcb, ptr, size, caller);
+#endif
+
+    return ptr;
+}
+
+
+/******************************************************************************
+*
+*   Add an extent to a task's heap that is big enough to allocate "size" 
+*   bytes with the given alignment from.  Return NULL if that would make the
+*   heap bigger than the task's limit or the global heap is out of memory.
+*/
+static HEAP *grow_task_heap(TCB *tcb, UINT size, UINT align) {
+
+    HEAP *h, *last;
+    UINT need, ext;
+
+    /*  The heap header, the block, and the worst case alignment padding  */
+    need = sizeof(HEAP) + HEAP_ROUND(size + sizeof(HCB));
+    if(align > HEAP_GRAIN)
+        need += align + sizeof(HCB) + HEAP_MIN_NODE_SIZE;
+    if(need < size)
+        return NULL;    /* wrapped around */
+
+    /*  Big blocks from the global heap are a power of two, so the extent
+        might as well use all of it.  */
+    for(ext = HEAP_EXTENT_SIZE; ext < need && ext * 2 > ext; ext *= 2)
+        ;
+    if(ext < need)
+        return NULL;
+
+    /*  Stay under the limit */
+    if(tcb->hsize >= tcb->hlimit)
+        return NULL;
+    if(ext > tcb->hlimit - tcb->hsize) {
+        ext = (tcb->hlimit - tcb->hsize) & ~HEAP_FLAG_MASK;
+        if(ext < need || ext < HEAP_MIN_SIZE)
+            return NULL;
+    }
+
+    /*  The allocation that needs the extent was already checked by 
+        alloc_allowed(), so go around global_alloc().  */
+    if((h = large_alloc(ext, 1)) == NULL)
+        return NULL;
+    init_heap((UCHAR *)h, ext);
+    SETFLAG(h->flags, HEAP_EXTENT);
+
+    /*  Extents are added to the end so the first ones are used first.  */
+    for(last = tcb->heap; last->next != NULL; last = last->next)
+        ;
+    last->next = h;
+    tcb->hsize += h->size;
+
+    return h;
+}
+
+
+/******************************************************************************
+*
+*   Free memory from a task's heap.  Find the extent that it belongs to and
+*   free it there.  An extent that becomes empty is given back to the global
+*   heap.  The first heap of the task is never given back.
+*/
+static int task_heap_free(TCB *tcb, void *ptr) {
+
+    HEAP *h, *prev = NULL;
+    HCB *next;
+    int hole;
+
+    for(h = tcb->heap; h != NULL; prev = h, h = h->next) {
+        if(HEAP_HAS_BLOCK(h, ptr))
+            break;
+    }
+
+    if(h == NULL || heap_verify_node(h, ptr))
+        return 1;
+
+#ifdef HEAP_PROFILE
+    profile_free(tcb, ptr);
+#endif
+
+    /*  The hole that is left can only be closed up if a handle's block comes
+        right after it.  Free blocks are always merged, so that is the next
+        block or the one after a free next block.  */
+    next = HCB_NEXT(HEAP_PTR_TO_HCB(ptr));
+    if((UCHAR *)next < HEAP_END(h) && !HCB_IS_USED(next))
+        next = HCB_NEXT(next);
+    hole = (UCHAR *)next < HEAP_END(h) && HCB_CAN_MOVE(next);
+
+    if(heap_free(h, ptr))
+        return 1;
+
+    if(hole)
+        SETFLAG(tcb->flags, TASK_COMPACT);
+
+    if(prev != NULL && h->used_blocks == 0) {
+        prev->next = h->next;
+        tcb->hsize -= h->size;
+        global_free(h);
+    }
+
+    return 0;
+}
+
+
+/******************************************************************************
+*
+*   Allocate a large block from the global heap.  It comes from the buddy 
+*   system if it can, or from the small block heap if the buddy system is
+*   out of memory.
+*/
+static void *large_alloc(UINT size, UINT align) {
+
+    void *ptr;
+
+    sys_lock(&global_lock);
+    if((ptr = buddy_alloc(size, align)) != NULL)
+        clear_memory(ptr, size);
+    else
+        ptr = heap_alloc(global_heap, size, align);
+    sys_unlock(&global_lock);
+
+    return ptr;
+}
+
+
+/******************************************************************************
+*
+*   Allocate memory from a single heap or extent.  This is the first fit
+*   search that all of the other allocation functions end up in.
 */
-static void *heap_alloc(HEAP *h, UINT size) {
+static void *extent_alloc(HEAP *h, UINT size, UINT align) {
 
     HEAP *heap;
     HCB *hcb, *nhcb;
-    UINT max_addr;
+    UINT need;
+    UINT pad = 0;
     void *ptr;
 
     /* do some sanity checking */
     if((heap = h) == NULL)
         return NULL;
 
-    if((UINT)heap != (UINT)heap->address)
+    if(align == 0 || (align & (align - 1)) != 0)
         return NULL;
 
+    if(heap != heap->address)
+        return NULL;
+
+    /* the size of the block, including the header */
+    need = HEAP_ROUND(size + sizeof(HCB));
+    if(need < size)
+        return NULL;    /* wrapped around */
+
     /* find a node of sufficient size */
-    /* calculate the highest address that is in the heap */
-    max_addr = (UINT)heap + heap->size;
-    for(hcb = (HCB *)((UINT)heap + sizeof(HEAP));
-                (UINT)hcb < max_addr;
-                (UINT)hcb += hcb->size) {
+    for(hcb = HEAP_FIRST_HCB(heap);
+                (UCHAR *)hcb < HEAP_END(heap);
+                hcb = HCB_NEXT(hcb)) {
 
         /* This is clearly impossable.  If it happens, then there was a
             catastrophic error some where.  In any case, fail to allocate
             the memory. */
-        if(hcb->size == 0 || hcb->status == 0) {
+        if(HCB_SIZE(hcb) == 0) {
             return NULL;
         }
 
         /* if it is free then we could be interested in it */
-        if(hcb->status == HEAP_STATUS_FREE) {
-            /* check the size */
-            if(hcb->size >= size + sizeof(HCB)) {
+        if(!HCB_IS_USED(hcb)) {
+            /* check the size, including what it takes to align it */
+            pad = align_padding(hcb, align);
+            if(HCB_SIZE(hcb) >= pad + need) {
                 break;  /* we have a winner.... */
             }
 
@@ -332,29 +1232,53 @@ static void *heap_alloc(HEAP *h, UINT size) {
     }
 
     /* did we find one? */
-    if((UINT)hcb >= max_addr)  {
+    if((UCHAR *)hcb >= HEAP_END(heap))  {
         /* nope... return an error */
         return NULL;
     }
 
-    /* change the status of the node */
-    hcb->status = HEAP_STATUS_USED;
+    /* if this was the largest free block, then nobody knows which one is
+        now.  Let heap_get_stats() find out if it is ever asked. */
+    if(HCB_SIZE(hcb) >= heap->largest_free)
+        SETFLAG(heap->flags, HEAP_STALE);
+    heap->free_blocks--;
+
+    /* split the alignment padding off as a free block */
+    if(pad != 0) {
+        nhcb = (HCB *)((UCHAR *)hcb + pad);
+        set_node(heap, nhcb, HCB_SIZE(hcb) - pad, pad);
+        set_node(heap, hcb, pad, hcb->prev);
+        if((UCHAR *)HCB_NEXT(nhcb) < HEAP_END(heap))
+            HCB_NEXT(nhcb)->prev = HCB_SIZE(nhcb);
+        hcb = nhcb;
+        heap->free_blocks++;
+    }
 
     /* allocate from it */
 
     /* we have a node with enough room in it.  Do we want to split it or just
         ignore the left over space? */
-    if(hcb->size > (size + sizeof(HCB) + HEAP_MIN_NODE_SIZE)) {
+    if(HCB_SIZE(hcb) >= need + sizeof(HCB) + HEAP_MIN_NODE_SIZE) {
         /* split it */
-        nhcb = (HCB *)((UINT)hcb + size + sizeof(HCB));
-        nhcb->magic = HEAP_MAGIC;
-        nhcb->status = HEAP_STATUS_FREE;
-        nhcb->start = hcb->start + size + sizeof(HCB);
-        nhcb->size = hcb->size - (size + sizeof(HCB));
-        hcb->size = size + sizeof(HCB);
+        nhcb = (HCB *)((UCHAR *)hcb + need);
+        set_node(heap, nhcb, HCB_SIZE(hcb) - need, need);
+        set_node(heap, hcb, need, hcb->prev);
+        if((UCHAR *)HCB_NEXT(nhcb) < HEAP_END(heap))
+            HCB_NEXT(nhcb)->prev = HCB_SIZE(nhcb);
+        heap->free_blocks++;
     }
     /* else we are done */
 
+    /* change the status of the node */
+    SETFLAG(hcb->size, HEAP_STATUS_USED);
+
+    /* keep the statistics */
+    heap->used += HCB_SIZE(hcb);
+    heap->used_blocks++;
+    heap->allocs++;
+    if(heap->used > heap->high_water)
+        heap->high_water = heap->used;
+
     /* clear the memory... */
     ptr =  HEAP_HCB_TO_PTR(hcb);
     clear_memory(ptr, size);
@@ -387,44 +1311,229 @@ static void *heap_realloc(HEAP *h, void *ptr, UINT size) {
 *   Free a memory block allocated by alloc() or realloc() and recombine free 
 *   data areas.  If there is no error, then return 0. Otherwise return a 
 *   non-zero error code.
+*
+*   Since every HCB knows the size of the block before it, the free'd block
+*   is merged with the blocks on both sides of it without walking the heap.
 */
 static int heap_free(HEAP *h, void *ptr) {
 
-    HCB *hcb, *fhcb = NULL;
-    UINT max_addr;
-    int free_flag = 0;
+    HCB *hcb, *nhcb;
+
+    /* make sure that this is an allocated block from this heap */
+    if(heap_verify_node(h, ptr))
+        return 1;
 
     hcb = HEAP_PTR_TO_HCB(ptr);
 
-    /* mark this one as free */
-    hcb->status = HEAP_STATUS_FREE;
+    /* mark this one as free, which also clears the handle flags */
+    hcb->size = HCB_SIZE(hcb);
+
+    /* keep the statistics */
+    h->used -= HCB_SIZE(hcb);
+    h->used_blocks--;
+    h->free_blocks++;
+    h->frees++;
+
+    /* merge with the next block if it is free.  If heap_verify_step() was
+        going to check a block that is merged away, then it checks the merged
+        block instead.  */
+    nhcb = HCB_NEXT(hcb);
+    if((UCHAR *)nhcb < HEAP_END(h) && !HCB_IS_USED(nhcb)) {
+        if(h->verify == (UINT)((UCHAR *)nhcb - (UCHAR *)h))
+            h->verify = (UINT)((UCHAR *)hcb - (UCHAR *)h);
+        set_node(h, hcb, HCB_SIZE(hcb) + HCB_SIZE(nhcb), hcb->prev);
+        h->free_blocks--;
+    }
 
-    /* walk the list and merge all of the free items */
-    max_addr = (UINT)h + h->size;
-    for(hcb = (HCB *)((UINT)h + sizeof(HEAP));
-                (UINT)hcb < max_addr;
-                (UINT)hcb += hcb->size) {
+    /* merge with the previous block if it is free */
+    if(hcb->prev != 0 && !HCB_IS_USED(HCB_PREV(hcb))) {
+        nhcb = HCB_PREV(hcb);
+        if(h->verify == (UINT)((UCHAR *)hcb - (UCHAR *)h))
+            h->verify = (UINT)((UCHAR *)nhcb - (UCHAR *)h);
+        set_node(h, nhcb, HCB_SIZE(nhcb) + HCB_SIZE(hcb), nhcb->prev);
+        hcb = nhcb;
+        h->free_blocks--;
+    }
 
-        /* if it is free then we could be interested in it */
-        if(hcb->status == HEAP_STATUS_FREE) {
-            /* are we in the state of merging blocks? */
-            if(free_flag) {
-                /* when we reach here, we have already encountered a free
-                    block that we can merge this one with. */
-                fhcb->size += hcb->size;
-            }
-            else {
-                /* no so go there */
-                free_flag = 1;
-                fhcb = hcb;
-            }
+    /* fix the link back from the block after the merged one */
+    nhcb = HCB_NEXT(hcb);
+    if((UCHAR *)nhcb < HEAP_END(h))
+        nhcb->prev = HCB_SIZE(hcb);
+
+    /* the merged block could be the new largest one */
+    if(HCB_SIZE(hcb) > h->largest_free)
+        h->largest_free = HCB_SIZE(hcb);
+
+    return 0;
+}
+
+
+/******************************************************************************
+*
+*   Find out whether an allocation is allowed.  After the system or the 
+*   current task has declared it's initialization complete, the allocation 
+*   is counted and the first one is remembered.  Return zero if it should 
+*   fail.
+*/
+static int alloc_allowed(UINT size, void *caller) {
+
+    TCB *tcb;
+    UINT policy = system_policy;
+
+    if((tcb = get_current_task_tcb()) != NULL) {
+        if(TESTFLAG(tcb->flags, TASK_INIT_DONE))
+            policy |= ALLOC_REPORT;
+        if(TESTFLAG(tcb->flags, TASK_ALLOC_FAIL))
+            policy |= ALLOC_FAIL;
+    }
+
+    if(policy == ALLOC_ALLOW)
+        return 1;
+
+    sys_lock(&global_lock);
+    if(alloc_check.count++ == 0) {
+        alloc_check.task_number = (tcb != NULL)? tcb->task_number: 0;
+        alloc_check.caller = caller;
+        alloc_check.size = size;
+    }
+    sys_unlock(&global_lock);
+
+    return !TESTFLAG(policy, ALLOC_FAIL);
+}
+
+
+/******************************************************************************
+*
+*   Compact one extent of a task heap.  Every time a free block is followed
+*   by a block that can move, the two trade places.  The free block then
+*   merges with the free block after it, if there is one, and goes on down
+*   the heap until it comes to a block that can't move.
+*/
+static UINT compact_extent(HEAP *h) {
+
+    HCB *hcb, *nhcb;
+    UINT moved = 0;
+
+    for(hcb = HEAP_FIRST_HCB(h); (UCHAR *)hcb < HEAP_END(h); ) {
+        nhcb = HCB_NEXT(hcb);
+        if(!HCB_IS_USED(hcb) && (UCHAR *)nhcb < HEAP_END(h) && 
+                    HCB_CAN_MOVE(nhcb)) {
+            hcb = slide_block(h, hcb);
+            moved++;
         }
         else
-            free_flag = 0;
+            hcb = nhcb;
     }
 
+    /*  The blocks have moved under the background heap check. */
+    if(moved != 0)
+        h->verify = 0;
 
-    return 0;
+    return moved;
+}
+
+
+/******************************************************************************
+*
+*   Move the handle block that comes after the free block "hcb" down to 
+*   where the free block starts and put the free block after it.  The first
+*   word of a handle block is the address of it's master pointer, which is 
+*   updated to the new place.  Return the free block.
+*/
+static HCB *slide_block(HEAP *h, HCB *hcb) {
+
+    HCB *mhcb, *nhcb;
+    UINT fsize, msize, flags, prev;
+    void ***master;
+
+    mhcb = HCB_NEXT(hcb);
+    fsize = HCB_SIZE(hcb);
+    msize = HCB_SIZE(mhcb);
+    flags = mhcb->size & HEAP_FLAG_MASK;
+    prev = hcb->prev;
+
+    /*  The header moves with the block.  set_node() puts the magic number
+        and offset of the new place in it.  copy_memory() copies from the 
+        front, so it is safe for the blocks to overlap.  */
+    copy_memory(hcb, mhcb, msize);
+    set_node(h, hcb, msize | flags, prev);
+    master = (void ***)HEAP_HCB_TO_PTR(hcb);
+    **master = (UCHAR *)master + sizeof(void **);
+
+    /*  The free block goes after it, merged with the next one if it can be */
+    nhcb = (HCB *)((UCHAR *)hcb + msize);
+    set_node(h, nhcb, fsize, msize);
+    mhcb = HCB_NEXT(nhcb);
+    if((UCHAR *)mhcb < HEAP_END(h) && !HCB_IS_USED(mhcb)) {
+        set_node(h, nhcb, fsize + HCB_SIZE(mhcb), msize);
+        h->free_blocks--;
+        mhcb = HCB_NEXT(nhcb);
+    }
+    if((UCHAR *)mhcb < HEAP_END(h))
+        mhcb->prev = HCB_SIZE(nhcb);
+
+    if(HCB_SIZE(nhcb) > h->largest_free)
+        h->largest_free = HCB_SIZE(nhcb);
+
+    return nhcb;
+}
+
+
+/******************************************************************************
+*
+*   Work out how much of the free memory is not in the largest free block, 
+*   as a percentage.
+*/
+static void set_fragmentation(HEAP_STATS *stats) {
+
+    if(stats->free == 0)
+        stats->fragmentation = 0;
+    else
+        stats->fragmentation = (UINT)(((unsigned long long)
+                        (stats->free - stats->largest_free) * 100) / stats->free);
+}
+
+
+/******************************************************************************
+*
+*   Find the size of the largest free block by walking the heap.
+*/
+static UINT largest_free_block(HEAP *h) {
+
+    HCB *hcb;
+    UINT largest = 0;
+
+    for(hcb = HEAP_FIRST_HCB(h);
+                (UCHAR *)hcb < HEAP_END(h) && HCB_SIZE(hcb) != 0;
+                hcb = HCB_NEXT(hcb)) {
+
+        if(!HCB_IS_USED(hcb) && HCB_SIZE(hcb) > largest)
+            largest = HCB_SIZE(hcb);
+    }
+
+    return largest;
+}
+
+
+/******************************************************************************
+*
+*   Return the number of bytes that have to be skipped at the start of a free
+*   block so that the data area of the block that follows is aligned.  The 
+*   skipped bytes have to be zero or else big enough to be a free block.
+*/
+static UINT align_padding(HCB *hcb, UINT align) {
+
+    UINT pad;
+
+    pad = (UPTR)HEAP_HCB_TO_PTR(hcb) & (align - 1);
+    if(pad == 0)
+        return 0;
+
+    pad = align - pad;
+    while(pad < sizeof(HCB) + HEAP_MIN_NODE_SIZE)
+        pad += align;
+
+    return pad;
 }
 
 
@@ -434,17 +1543,41 @@ static int heap_free(HEAP *h, void *ptr) {
 */
 static int verify_node(HEAP *h, HCB *hcb) {
 
+    UINT size = HCB_SIZE(hcb);
+
+#ifdef HEAP_CHECK_MAGIC
     /* check the magic number */
     if(hcb->magic != HEAP_MAGIC)
         return 1;
     /* check the address */
-    if(hcb->start != (UINT)(h)-(UINT)(hcb))
+    if(hcb->start != (UINT)((UCHAR *)hcb - (UCHAR *)h))
         return 2;
+#endif
+
+    /* check the size */
+    if(size < sizeof(HCB) || size > (UINT)(HEAP_END(h) - (UCHAR *)hcb))
+        return 3;
 
     /* no error */
     return 0;
 }
 
+
+/******************************************************************************
+*
+*   Fill in a HCB as a free block.  The size is rounded to the heap grain by 
+*   the caller.
+*/
+static inline void set_node(HEAP *h, HCB *hcb, UINT size, UINT prev) {
+
+#ifdef HEAP_CHECK_MAGIC
+    hcb->magic = HEAP_MAGIC;
+    hcb->start = (UINT)((UCHAR *)hcb - (UCHAR *)h);
+#endif
+    hcb->size = size;
+    hcb->prev = prev;
+}
+
 /******************************************************************************
 *
 *   Clear a block of memory using 32 bit words and then clear the remainder
@@ -477,7 +1610,6 @@ static void inline clear_memory(void *ptr, UINT size) {
 #if 0
 int print_heap(char *strg, HEAP *h) {
 
-    UINT max_addr;
     HCB *hcb;
     HEAP *heap;
 
@@ -486,26 +1618,24 @@ int print_heap(char *strg, HEAP *h) {
     if((heap = h) == NULL)
         return 1;
     else
-        fprintf(stdout, "Heap Handle = 0x%08X\n", (UINT)h);
+        fprintf(stdout, "Heap Handle = %p\n", (void *)h);
 
     if(heap->size < HEAP_MIN_SIZE)
         fprintf(stdout, "Heap size error:");
     
     fprintf(stdout, "  Heap size = 0x%08X\n", heap->size);
 
-    if((UINT)heap != (UINT)heap->address)
+    if(heap != heap->address)
         fprintf(stdout, "Heap address error:");
         
-    fprintf(stdout, "  Heap address = 0x%08X\n", (UINT)heap->address);
+    fprintf(stdout, "  Heap address = %p\n", (void *)heap->address);
 
-    /* calculate the highest address that is in the heap */
-    max_addr = (UINT)heap + heap->size;
-    for(hcb = (HCB *)((UINT)heap + sizeof(HEAP));
-                (UINT)hcb < max_addr;
-                (UINT)hcb += hcb->size) {
+    for(hcb = HEAP_FIRST_HCB(heap);
+                (UCHAR *)hcb < HEAP_END(heap);
+                hcb = HCB_NEXT(hcb)) {
 
 
-        if(hcb->size == 0 || hcb->status == 0) {
+        if(HCB_SIZE(hcb) == 0) {
             fprintf(stdout, "HEAP ERROR!\n");
             print_node(hcb);
             return 1;
@@ -525,14 +1655,15 @@ int print_heap(char *strg, HEAP *h) {
 */
 void print_node(HCB *hcb) {
 
-    /* check the magic number */
-    fprintf(stdout, "HCB handle = 0x%08X\n", (UINT)hcb);
+    fprintf(stdout, "HCB handle = %p\n", (void *)hcb);
+#ifdef HEAP_CHECK_MAGIC
     fprintf(stdout, "  hcb->magic  = 0X%08X\n", hcb->magic);
     fprintf(stdout, "  hcb->start  = 0X%08X\n", hcb->start);
-    fprintf(stdout, "  hcb->size   = 0X%08X (%d)\n", hcb->size, hcb->size);
+#endif
+    fprintf(stdout, "  hcb->size   = 0X%08X (%d)\n", HCB_SIZE(hcb), HCB_SIZE(hcb));
+    fprintf(stdout, "  hcb->prev   = 0X%08X (%d)\n", hcb->prev, hcb->prev);
     fprintf(stdout, "  hcb->status = %s\n",
-            (hcb->status == HEAP_STATUS_USED)? "ALLOCATED":
-            (hcb->status == HEAP_STATUS_FREE)? "FREE": "ERROR");
+            HCB_IS_USED(hcb)? "ALLOCATED": "FREE");
 }
 #endif
 
@@ -0,0 +1,301 @@
+/******************************************************************************
+*
+*   Message passing.
+*
+*     A message hands a block of data from one task to another.  
+*   send_msg_sync() copies the data into the receiver's heap, so it can be
+*   anything, such as a string or something on the stack.  
+*   send_msg_buffer() hands over a block that the sender got from 
+*   task_alloc() instead, so a large buffer costs no more to send than a
+*   small one.  The block stays in the sender's heap, which is kept in the
+*   message with heap_lend(), and the receiver frees it from there with
+*   free_message_data() when it is done with it.  If the sender exits first,
+*   then the part of it's heap that the block is in is kept until the
+*   receiver frees it.
+*
+*     The receiver is told that there are messages with a
+*   MESSAGE_ARRIVAL_EVENT.  The event is part of the message queue, so it is
+*   never allocated, and it stays in the event queue while there are any
+*   messages.  That way a task can wait for messages and other things at
+*   once with task_wait_any().
+*
+*     The message headers come from the global heap.  Messages that were
+*   received and not free'd yet are kept in a list, so that the heap that
+*   their data is in can be found, and so that they can be free'd if the
+*   receiver exits.
+*
+*/
+#include "kern.h"
+
+/* defined in event.c */
+extern int deliver_event(EVENT *event);
+extern int remove_event(TCB *tcb, EVENT *event);
+
+/* defined in memory.c */
+extern HEAP *heap_lend(TCB *tcb, void *ptr, UINT size);
+extern int heap_return(HEAP *h, TCB *tcb, void *ptr);
+
+static MESSAGE *new_message(TCB *tcb, TCB *current, UINT size);
+static int queue_message(MESSAGE *msg);
+static void free_message(MESSAGE *msg);
+
+/******************************************************************************
+*
+*   Send a copy of some data to a task and call the scheduler, so that the
+*   receiver runs now if it has a higher priority.  The sender can use the 
+*   data again as soon as this returns.  Return TASK_ERROR if there is no
+*   memory.
+*
+*/
+int send_msg_sync(TCB *tcb, void *data, UINT size) {
+
+    MESSAGE *msg;
+    TCB *current;
+
+    if(tcb == NULL || (current = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    if(size > 0 && data == NULL)
+        return TASK_ERROR;
+
+    if((msg = new_message(tcb, current, size)) == NULL)
+        return TASK_ERROR;
+
+    /*  The copy is lent by the receiver, so that it is free'd the same way
+        as a buffer that was handed over. */
+    if(size > 0) {
+        if((msg->msg = tcb_alloc(tcb, size)) == NULL ||
+                    (msg->heap = heap_lend(tcb, msg->msg, size)) == NULL) {
+            if(msg->msg != NULL)
+                tcb_free(tcb, msg->msg);
+            global_free(msg);
+            return TASK_ERROR;
+        }
+        copy_memory(msg->msg, data, size);
+        SETFLAG(msg->msg_flag, MESSAGE_COPIED);
+    }
+
+    return queue_message(msg);
+}
+
+
+/******************************************************************************
+*
+*   Hand a buffer to a task without copying it and call the scheduler.  The
+*   buffer has to be a block that the current task got from task_alloc(), 
+*   and it belongs to the receiver now, so the sender must not use it or 
+*   free it after this returns.  Return TASK_ERROR if it is not such a block
+*   or there is no memory.
+*
+*/
+int send_msg_buffer(TCB *tcb, void *data, UINT size) {
+
+    MESSAGE *msg;
+    TCB *current;
+
+    if(tcb == NULL || data == NULL || (current = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    if((msg = new_message(tcb, current, size)) == NULL)
+        return TASK_ERROR;
+
+    if((msg->heap = heap_lend(current, data, size)) == NULL) {
+        global_free(msg);
+        return TASK_ERROR;
+    }
+    msg->msg = data;
+
+    return queue_message(msg);
+}
+
+
+/******************************************************************************
+*
+*   Wait for the next message to the current task.  The data and it's size
+*   are returned, if the pointers are not NULL.  The data belongs to the
+*   receiver now, and it has to be given back with free_message_data().
+*   A message with no data has a NULL data pointer and nothing to give 
+*   back.  Return the sender.
+*
+*/
+TCB *receive_msg_sync(void **data, int *size) {
+
+    MESSAGE *msg;
+    MESSAGE_QUEUE *mq;
+    TCB *tcb, *sender;
+
+    if((tcb = get_current_task_tcb()) == NULL)
+        return NULL;
+
+    mq = tcb->message_queue;
+    while((msg = mq->first) == NULL) {
+        tcb->event_match = EVENT_MATCH_TYPE(MESSAGE_ARRIVAL_EVENT);
+        tcb->status = INCR_STATUS(tcb);
+        SETFLAG(tcb->flags, WAIT_FOR_EVENT);
+        yield();
+    }
+
+    mq->first = msg->next;
+    if(mq->first == NULL)
+        mq->last = NULL;
+    mq->num_msgs--;
+
+    /*  There is nothing left to tell the task about */
+    if(mq->first == NULL && TESTFLAG(mq->notice.flags, EVENT_QUEUED))
+        remove_event(tcb, &mq->notice);
+
+    if(data != NULL)
+        *data = msg->msg;
+    if(size != NULL)
+        *size = (int)msg->size;
+    sender = msg->sender;
+
+    /*  A message with no data has nothing to give back, so it is done */
+    if(msg->msg == NULL)
+        free_message(msg);
+    else {
+        msg->next = mq->held;
+        mq->held = msg;
+    }
+
+    return sender;
+}
+
+
+/******************************************************************************
+*
+*   Give back the data of a message that the current task received.  It is
+*   free'd from the heap that it is in, which is usually the sender's.
+*   Return TASK_ERROR if it is not the data of a message that was received.
+*
+*/
+int free_message_data(void *data) {
+
+    MESSAGE *msg, *prev = NULL;
+    MESSAGE_QUEUE *mq;
+    TCB *tcb;
+
+    if(data == NULL || (tcb = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    mq = tcb->message_queue;
+    for(msg = mq->held; msg != NULL && msg->msg != data; msg = msg->next)
+        prev = msg;
+
+    if(msg == NULL)
+        return TASK_ERROR;
+
+    if(prev == NULL)
+        mq->held = msg->next;
+    else
+        prev->next = msg->next;
+
+    free_message(msg);
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Free the messages of a task that is exiting, the ones that it has not
+*   received and the ones that it has not free'd.  It's event queue has been
+*   emptied already.  What it sent is taken care of when it's heap is free'd.
+*
+*/
+void free_task_messages(TCB *tcb) {
+
+    MESSAGE_QUEUE *mq = tcb->message_queue;
+    MESSAGE *msg;
+
+    while((msg = mq->first) != NULL) {
+        mq->first = msg->next;
+        free_message(msg);
+    }
+    mq->last = NULL;
+    mq->num_msgs = 0;
+
+    while((msg = mq->held) != NULL) {
+        mq->held = msg->next;
+        free_message(msg);
+    }
+}
+
+
+/******************************************************************************
+*
+*   STATIC FUNCTIONS
+*
+*/
+/******************************************************************************
+*
+*   Allocate a message from "current" to "tcb" with no data yet.  Return
+*   NULL if there is no memory.
+*
+*/
+static MESSAGE *new_message(TCB *tcb, TCB *current, UINT size) {
+
+    MESSAGE *msg;
+
+    if((msg = global_alloc(sizeof(MESSAGE))) == NULL)
+        return NULL;
+
+    msg->msg_type = NORMAL_MESSAGE;
+    msg->msg_flag = MESSAGE_NO_RECIPT;
+    msg->sender = current;
+    msg->destination = tcb;
+    msg->size = size;
+    msg->msg = NULL;
+    msg->heap = NULL;
+    msg->next = NULL;
+
+    return msg;
+}
+
+
+/******************************************************************************
+*
+*   Put a message on the receiver's queue, tell it, and call the scheduler.
+*
+*/
+static int queue_message(MESSAGE *msg) {
+
+    MESSAGE_QUEUE *mq = msg->destination->message_queue;
+
+    if(mq->last == NULL)
+        mq->first = msg;
+    else
+        mq->last->next = msg;
+    mq->last = msg;
+    mq->num_msgs++;
+
+    if(!TESTFLAG(mq->notice.flags, EVENT_QUEUED)) {
+        SETFLAG(mq->notice.flags, EVENT_QUEUED);
+        mq->notice.sender = msg->sender;
+        deliver_event(&mq->notice);
+    }
+
+    yield();
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Free a message and it's data.  The data is in the receiver's heap if it
+*   was copied, otherwise it is in the sender's.
+*
+*/
+static void free_message(MESSAGE *msg) {
+
+    TCB *owner;
+
+    if(msg->msg != NULL) {
+        owner = (TESTFLAG(msg->msg_flag, MESSAGE_COPIED))?
+                    msg->destination: msg->sender;
+        heap_return(msg->heap, owner, msg->msg);
+    }
+
+    global_free(msg);
+}
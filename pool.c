@@ -0,0 +1,128 @@
+/******************************************************************************
+*
+*   Fixed size object pools.
+*
+*     A pool is a single block that is allocated from the task's heap and cut
+*   up into objects that are all the same size.  The objects that are not in
+*   use are kept in a list that is linked through the first word of each
+*   object, so getting and putting an object is just a push or a pop.  There
+*   is no search of the heap and no header on each object.
+*
+*     Since the whole pool is one heap block, it is destroyed with a single
+*   free, and it goes away with the rest of the task's heap when the task
+*   is killed or returns.
+*
+*/
+#include "kern.h"
+
+/******************************************************************************
+*
+*   Create a pool of "count" objects of "obj_size" bytes in the current
+*   task's heap.  Return a pointer to the pool, or NULL if there is not enough
+*   memory in the heap.
+*
+*/
+POOL *task_pool_create(UINT obj_size, UINT count) {
+
+    POOL *pool;
+    UCHAR *obj;
+    UINT size, idx;
+
+    if(obj_size == 0 || count == 0)
+        return NULL;
+
+    /*  Every object has to be able to hold the free list pointer and keep
+        the object after it aligned.  */
+    if(obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+    if(HEAP_ROUND(obj_size) < obj_size)
+        return NULL;
+    obj_size = HEAP_ROUND(obj_size);
+
+    /*  Watch out for sizes that wrap around.  */
+    size = HEAP_ROUND(sizeof(POOL));
+    if(count > (~0U - size) / obj_size)
+        return NULL;
+    size += obj_size * count;
+
+    if((pool = task_alloc(size)) == NULL)
+        return NULL;
+
+    pool->obj_size = obj_size;
+    pool->count = count;
+    pool->num_free = count;
+    pool->owner = get_current_task_tcb();
+    pool->objects = (UCHAR *)pool + HEAP_ROUND(sizeof(POOL));
+
+    /*  Link all of the objects into the free list, in address order. */
+    pool->free_list = NULL;
+    for(idx = count; idx > 0; idx--) {
+        obj = pool->objects + (idx - 1) * obj_size;
+        *(void **)obj = pool->free_list;
+        pool->free_list = obj;
+    }
+
+    return pool;
+}
+
+
+/******************************************************************************
+*
+*   Get an object from the pool.  Return NULL if the pool is empty.
+*
+*/
+void *pool_get(POOL *pool) {
+
+    void *obj;
+
+    if(pool == NULL || (obj = pool->free_list) == NULL)
+        return NULL;
+
+    pool->free_list = *(void **)obj;
+    pool->num_free--;
+
+    return obj;
+}
+
+
+/******************************************************************************
+*
+*   Return an object to the pool.  If the object did not come from this pool,
+*   then return TASK_ERROR.
+*
+*/
+int pool_put(POOL *pool, void *obj) {
+
+    UINT offset;
+
+    if(pool == NULL || obj == NULL)
+        return TASK_ERROR;
+
+    /*  Make sure that it is the start of an object in this pool. */
+    if((UCHAR *)obj < pool->objects)
+        return TASK_ERROR;
+    offset = (UINT)((UCHAR *)obj - pool->objects);
+    if(offset >= pool->obj_size * pool->count || offset % pool->obj_size)
+        return TASK_ERROR;
+
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->num_free++;
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Destroy a pool.  All of the objects are released at once, whether or not
+*   they were put back.  There is no need to call this before a task exits.
+*
+*/
+int pool_destroy(POOL *pool) {
+
+    if(pool == NULL)
+        return TASK_ERROR;
+
+    return tcb_free(pool->owner, pool)? TASK_ERROR: TASK_SUCCESS;
+}
@@ -0,0 +1,208 @@
+/******************************************************************************
+*
+*   Task heap allocation profiler.
+*
+*     When HEAP_PROFILE is defined, every block that is allocated from a task
+*   heap is tagged with the call site that asked for it.  The call site is
+*   the return address of the call to task_alloc(), task_alloc_aligned() or
+*   tcb_alloc().  Each task has a table of call sites, one entry for each
+*   call site and size class, that counts the blocks that are live now and
+*   the most that were ever live at once.
+*
+*     The table is a small hash table that is allocated from the global heap
+*   the first time the task allocates something, so the task's own heap is
+*   not changed by profiling it.  Finding the entry takes a hash and, most
+*   of the time, one compare.  If the table fills up, the call sites that do
+*   not fit are not tracked.
+*
+*     When the task exits, the table is printed before the heap is thrown
+*   away.  Anything that is still live at that point was leaked.  The table
+*   can also be printed at any time with task_heap_profile().
+*
+*/
+#if ! __RUN_AS_KERNEL__
+#include <stdio.h>
+#endif
+
+#include "kern.h"
+
+#ifdef HEAP_PROFILE
+
+static UINT size_class(UINT size);
+static UINT find_site(HEAP_SITE *table, void *caller, UINT cls);
+
+/******************************************************************************
+*
+*   Record an allocation from a task heap.  This is called by memory.c after
+*   the block was allocated.
+*
+*/
+void profile_alloc(TCB *tcb, void *ptr, UINT size, void *caller) {
+
+    HEAP_SITE *site;
+    HCB *hcb;
+    UINT idx;
+
+    hcb = HEAP_PTR_TO_HCB(ptr);
+    hcb->site = 0;
+    hcb->request = size;
+
+    if(tcb->profile == NULL) {
+        tcb->profile = global_alloc(sizeof(HEAP_SITE) * HEAP_PROFILE_SITES);
+        if(tcb->profile == NULL)
+            return;
+    }
+
+    if((idx = find_site(tcb->profile, caller, size_class(size))) >=
+                HEAP_PROFILE_SITES)
+        return;     /* the table is full */
+
+    site = &tcb->profile[idx];
+    site->allocs++;
+    site->live++;
+    site->live_bytes += size;
+    if(site->live > site->peak)
+        site->peak = site->live;
+    if(site->live_bytes > site->peak_bytes)
+        site->peak_bytes = site->live_bytes;
+
+    hcb->site = idx + 1;
+}
+
+
+/******************************************************************************
+*
+*   Record that a block from a task heap is being free'd.  This is called by
+*   memory.c after it has checked that the block is allocated.
+*
+*/
+void profile_free(TCB *tcb, void *ptr) {
+
+    HEAP_SITE *site;
+    HCB *hcb;
+
+    hcb = HEAP_PTR_TO_HCB(ptr);
+    if(tcb->profile == NULL || hcb->site == 0 || hcb->site > HEAP_PROFILE_SITES)
+        return;
+
+    site = &tcb->profile[hcb->site - 1];
+    site->live--;
+    site->live_bytes -= hcb->request;
+    hcb->site = 0;
+}
+
+
+/******************************************************************************
+*
+*   Print the profile of a task that is exiting and free the table.  Blocks
+*   that are still live are reported as leaks.
+*
+*/
+void free_task_profile(TCB *tcb) {
+
+    if(tcb->profile == NULL)
+        return;
+
+    task_heap_profile(tcb);
+    global_free(tcb->profile);
+    tcb->profile = NULL;
+}
+
+#endif /* HEAP_PROFILE */
+
+/******************************************************************************
+*
+*   Print the allocations of a task by call site.  A NULL TCB means the
+*   current task.  Return TASK_ERROR if there is nothing to print, which is
+*   always the case if HEAP_PROFILE is not defined.
+*
+*/
+int task_heap_profile(TCB *tcb) {
+
+#ifdef HEAP_PROFILE
+    HEAP_SITE *site;
+    UINT idx, live = 0, live_bytes = 0;
+
+    if(tcb == NULL && (tcb = get_current_task_tcb()) == NULL)
+        return TASK_ERROR;
+
+    if(tcb->profile == NULL)
+        return TASK_ERROR;
+
+#if ! __RUN_AS_KERNEL__
+    printf("task %u heap profile:\n", tcb->task_number);
+    printf("  %-18s %10s %6s %8s %6s %8s %8s\n", "call site", "size",
+                "live", "bytes", "peak", "bytes", "allocs");
+#endif
+    for(idx = 0; idx < HEAP_PROFILE_SITES; idx++) {
+        site = &tcb->profile[idx];
+        if(site->allocs == 0)
+            continue;
+        live += site->live;
+        live_bytes += site->live_bytes;
+#if ! __RUN_AS_KERNEL__
+        printf("  %-18p %10u %6u %8u %6u %8u %8u\n", site->caller,
+                    1U << site->size_class, site->live, site->live_bytes,
+                    site->peak, site->peak_bytes, site->allocs);
+#endif
+    }
+#if ! __RUN_AS_KERNEL__
+    printf("  %u blocks, %u bytes live\n", live, live_bytes);
+#endif
+
+    return TASK_SUCCESS;
+#else
+    return TASK_ERROR;
+#endif
+}
+
+
+#ifdef HEAP_PROFILE
+/******************************************************************************
+*
+*   STATIC FUNCTIONS
+*
+*/
+/******************************************************************************
+*
+*   Return the size class of a request, which is the smallest power of 2
+*   that it fits in.
+*
+*/
+static UINT size_class(UINT size) {
+
+    UINT cls = 0;
+
+    while(cls < 31 && (1U << cls) < size)
+        cls++;
+
+    return cls;
+}
+
+
+/******************************************************************************
+*
+*   Find the entry in a call site table for a call site and size class.  If
+*   there is none, then a free entry is used.  Return HEAP_PROFILE_SITES if
+*   the table is full.
+*
+*/
+static UINT find_site(HEAP_SITE *table, void *caller, UINT cls) {
+
+    UINT idx, n;
+
+    idx = (UINT)(((UPTR)caller >> 2) ^ ((UPTR)caller >> 9) ^ cls);
+    for(n = 0; n < HEAP_PROFILE_SITES; n++, idx++) {
+        idx &= HEAP_PROFILE_SITES - 1;
+        if(table[idx].allocs == 0) {
+            table[idx].caller = caller;
+            table[idx].size_class = cls;
+            return idx;
+        }
+        if(table[idx].caller == caller && table[idx].size_class == cls)
+            return idx;
+    }
+
+    return HEAP_PROFILE_SITES;
+}
+#endif /* HEAP_PROFILE */
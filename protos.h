@@ -263,6 +263,27 @@ void task_start_critical(void);
 */
 void task_end_critical(void);
 
+/******************************************************************************
+*
+*   Find out whether the background heap check has found a corrupt task 
+*   heap.  The scheduler checks HEAP_VERIFY_NODES blocks of the task heaps
+*   every time it runs, so a heap that was overwritten is found soon after, 
+*   not when an allocation happens to trip over it.
+*
+*   Parameters:
+*       HEAP_CHECK *report  Where to put the task number, extent and offset
+*                       of the first bad block that was found.  Can be NULL.
+*
+*   Returns:
+*       TASK_SUCCESS if no corrupt heap was found, otherwise TASK_ERROR.
+*
+*   Example:
+*       if(task_heap_check(&report) != TASK_SUCCESS)
+*           printf("task %u heap is corrupt\n", report.task_number);
+*
+*/
+int task_heap_check(HEAP_CHECK *report);
+
 
 /* defined in memory.c */
 /******************************************************************************
@@ -293,6 +314,30 @@ HEAP *init_heap(UCHAR *start, UINT size);
 */
 void *global_alloc(UINT size);
 
+/******************************************************************************
+*
+*   Allocate a block from the global heap whose address is a multiple of the
+*   requested alignment.  The memory is cleared before it is returned.  Free
+*   the block with "global_free()" as usual.  The padding that was skipped to
+*   align the block is returned to the heap as free memory.
+*
+*   Parameters:
+*       UINT size       Number of bytes to allocate.
+*
+*       UINT align      Required alignment in bytes.  This must be a power of 
+*                       two, such as HEAP_ALIGN_SIMD, HEAP_ALIGN_CACHE or 
+*                       HEAP_ALIGN_PAGE.
+*
+*   Returns:
+*       Pointer to the aligned memory, or NULL if there is not enough memory
+*       or the alignment is not a power of two.
+*
+*   Example:
+*       buf = global_alloc_aligned(1024, HEAP_ALIGN_CACHE);
+*
+*/
+void *global_alloc_aligned(UINT size, UINT align);
+
 /******************************************************************************
 *
 *   Function prototypes and associated documentation.
@@ -321,6 +366,26 @@ void *global_realloc(void *ptr, UINT size);
 */
 int global_free(void *ptr);
 
+/******************************************************************************
+*
+*   Give the blocks in the calling host thread's cache back to the global 
+*   heap.  Small global heap blocks are cached by each host thread so that
+*   "global_alloc()" and "global_free()" usually do not have to take the 
+*   global heap lock.  A host thread that is going away should call this so 
+*   that the blocks it has cached are not lost.
+*
+*   Parameters:
+*       none.
+*
+*   Returns:
+*       nothing.
+*
+*   Example:
+*       global_cache_flush();
+*
+*/
+void global_cache_flush(void);
+
 /******************************************************************************
 *
 *   Function prototypes and associated documentation.
@@ -335,6 +400,27 @@ int global_free(void *ptr);
 */
 void *task_alloc(UINT size);
 
+/******************************************************************************
+*
+*   Allocate a block from the current task's heap whose address is a multiple 
+*   of the requested alignment.  This is the same as "global_alloc_aligned()"
+*   except that the memory comes from the task's heap and is free'd with 
+*   "task_free()".
+*
+*   Parameters:
+*       UINT size       Number of bytes to allocate.
+*
+*       UINT align      Required alignment in bytes.  Must be a power of two.
+*
+*   Returns:
+*       Pointer to the aligned memory, or NULL if there is an error.
+*
+*   Example:
+*       samples = task_alloc_aligned(256 * sizeof(float), HEAP_ALIGN_SIMD);
+*
+*/
+void *task_alloc_aligned(UINT size, UINT align);
+
 /******************************************************************************
 *
 *   Function prototypes and associated documentation.
@@ -433,120 +519,1300 @@ int heap_verify_node(HEAP *h, void *node);
 */
 int heap_walk(HEAP *h);
 
-/* defined in system.c */
 /******************************************************************************
 *
-*   Function prototypes and associated documentation.
+*   Check a few blocks of a heap, starting where the last call left off.  It
+*   does the same checks as "heap_walk()" but the time it takes is bounded 
+*   by the count, not the size of the heap.  When the end of the heap is 
+*   reached, h->passes is incremented and the next call starts over.
+*
+*   Parameters:
+*       HEAP *h         Heap to check.
+*
+*       UINT count      Most blocks to check in this call.
+*
+*       UINT *offset    Where to put the offset of the bad block from the 
+*                       start of the heap if one is found.
+*
+*   Returns:
+*       Zero if there is nothing wrong, otherwise the same error code as 
+*       "heap_walk()".  The heap is marked HEAP_CORRUPT.
 *
+*   Example:
+*       if(heap_verify_step(tcb->heap, 8, &offset) != 0) ...
+*
+*/
+int heap_verify_step(HEAP *h, UINT count, UINT *offset);
+
+/******************************************************************************
+*
+*   Get the statistics of a heap.  The counters are kept up to date by the 
+*   allocator as it goes, so this call is cheap enough to make from a monitor
+*   task every second or so.  The heap is only walked if the largest free
+*   block was used up since the last call.
 *
 *   Parameters:
+*       HEAP *h         Heap to get the statistics of.
+*
+*       HEAP_STATS *stats   Where to put the statistics.  See kern.h for the
+*                       meaning of the fields.
 *
 *   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the heap is not valid.
 *
-*   Notes:
+*   Example:
+*       heap_get_stats(tcb->heap, &stats);
 *
 */
-int setup_stack_frame(TCB *tcb, void *entry);
+int heap_get_stats(HEAP *h, HEAP_STATS *stats);
 
-#ifndef _USE_SETJMP_
 /******************************************************************************
 *
-*   Function prototypes and associated documentation.
+*   Get the statistics of a task's heap.  This is the same as 
+*   "heap_get_stats()" for the heap of the given task.
+*
+*   Parameters:
+*       TCB *tcb        Task to get the heap statistics of.  If this is NULL,
+*                       then the current task is used.
+*
+*       HEAP_STATS *stats   Where to put the statistics.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if there is an error.
+*
+*   Example:
+*       task_heap_stats(NULL, &stats);
+*
+*/
+int task_heap_stats(TCB *tcb, HEAP_STATS *stats);
+
+/******************************************************************************
 *
+*   Get the statistics of the global heap.
 *
 *   Parameters:
+*       HEAP_STATS *stats   Where to put the statistics.
 *
 *   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if there is an error.
 *
-*   Notes:
+*   Example:
+*       global_heap_stats(&stats);
 *
 */
-int save_task_context(TASK_CONTEXT tc);
+int global_heap_stats(HEAP_STATS *stats);
 
 /******************************************************************************
 *
-*   Function prototypes and associated documentation.
+*   Set how big a task's heap is allowed to grow.  When a task's heap runs
+*   out of memory, it grows by taking another extent from the global heap 
+*   instead of failing, as long as the total stays under this limit.  An 
+*   extent that becomes empty is given back to the global heap.  Tasks start
+*   out with a limit of the larger of their heap size and DEFAULT_HEAP_LIMIT.
+*
+*   Parameters:
+*       TCB *tcb        Task to set the limit for.  If this is NULL, then the
+*                       current task is used.
+*
+*       UINT limit      Total heap size, in bytes, that the task may grow to.
+*                       Use the size given to "task_create()" to keep the 
+*                       heap from growing at all.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if there is an error.
 *
+*   Example:
+*       task_set_heap_limit(tcb, 64 * 1024);
+*
+*/
+int task_set_heap_limit(TCB *tcb, UINT limit);
+
+/******************************************************************************
+*
+*   Declare that the current task is done initializing.  A task in a hard 
+*   real time loop should not touch the heap, and this is how to prove that 
+*   it doesn't.  After this call, every allocation that the task makes from
+*   it's own heap or the global heap, including the ones that the kernel 
+*   makes for it, is counted.  See "alloc_check_report()".
 *
 *   Parameters:
+*       UINT policy     ALLOC_REPORT to count the allocations, ALLOC_FAIL to 
+*                       also make them fail, or ALLOC_ALLOW to go back to 
+*                       the init phase.
 *
 *   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if there is no current task.
 *
-*   Notes:
+*   Example:
+*       task_init_complete(ALLOC_FAIL);
 *
 */
-void restore_task_context(TASK_CONTEXT tc, UINT code);
-#endif
+int task_init_complete(UINT policy);
 
 /******************************************************************************
 *
-*   Function prototypes and associated documentation.
+*   Declare that the whole system is done initializing.  This works like 
+*   "task_init_complete()" for every task at once.
+*
+*   Parameters:
+*       UINT policy     ALLOC_REPORT, ALLOC_FAIL or ALLOC_ALLOW.
+*
+*   Returns:
+*       nothing.
 *
+*   Example:
+*       system_init_complete(ALLOC_REPORT);
+*
+*/
+void system_init_complete(UINT policy);
+
+/******************************************************************************
+*
+*   Find out whether any allocations were made after initialization was 
+*   declared complete.
 *
 *   Parameters:
+*       ALLOC_CHECK *report Where to put the number of them and the task, 
+*                       call site and size of the first one.  Can be NULL.
 *
 *   Returns:
+*       TASK_SUCCESS if there were none, otherwise TASK_ERROR.
 *
-*   Notes:
+*   Example:
+*       if(alloc_check_report(&report) != TASK_SUCCESS)
+*           printf("task %u allocated from %p\n", report.task_number, 
+*                   report.caller);
 *
 */
-void halt_processor(void);
+int alloc_check_report(ALLOC_CHECK *report);
 
 /******************************************************************************
 *
-*   Function prototypes and associated documentation.
+*   Compact a task's heap by moving the blocks of it's handles that are not
+*   locked down into the free space in front of them.  The scheduler does 
+*   this between tasks for a task that has free'd memory, and the allocator
+*   does it when a task's heap is too full, so it is rarely needed.
+*
+*   Parameters:
+*       TCB *tcb        Task to compact the heap of.  NULL means the current
+*                       task.
+*
+*   Returns:
+*       Number of blocks that were moved.
+*
+*   Example:
+*       task_heap_compact(NULL);
 *
+*/
+UINT task_heap_compact(TCB *tcb);
+
+/* defined in handle.c */
+/******************************************************************************
+*
+*   Allocate memory from the current task's heap that the kernel is allowed
+*   to move to keep the heap from fragmenting.  The memory is gotten from the
+*   handle with *handle, or with "handle_lock()".  A pointer that is gotten
+*   with *handle is only good until the task yields or allocates memory.
 *
 *   Parameters:
+*       UINT size       Number of bytes to allocate.
 *
 *   Returns:
+*       The handle, or NULL if there is not enough memory.  The memory is 
+*       cleared.
 *
-*   Notes:
+*   Example:
+*       HANDLE h = task_handle_alloc(sizeof(TABLE));
+*       ((TABLE *)*h)->count = 0;
 *
 */
-int sys_check_stack(TCB *tcb);
+HANDLE task_handle_alloc(UINT size);
 
-/* defined in event.c */
 /******************************************************************************
 *
-*   Function prototypes and associated documentation.
+*   Lock a handle so that it's memory can't be moved.  The pointer that is 
+*   returned is good until "handle_unlock()" is called.
+*
+*   Parameters:
+*       HANDLE handle   Handle that was returned by "task_handle_alloc()".
+*
+*   Returns:
+*       Pointer to the memory, or NULL if the handle is not valid.
+*
+*   Example:
+*       table = handle_lock(h);
+*
+*/
+void *handle_lock(HANDLE handle);
+
+/******************************************************************************
 *
+*   Unlock a handle so that it's memory can be moved again.
 *
 *   Parameters:
+*       HANDLE handle   Handle that was locked.
 *
 *   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the handle is not valid.
 *
-*   Notes:
+*   Example:
+*       handle_unlock(h);
 *
 */
-int generate_event(TCB *tcb, UINT type, UINT subtype);
+int handle_unlock(HANDLE handle);
 
 /******************************************************************************
 *
-*   Function prototypes and associated documentation.
+*   Free a handle and it's memory.  There is no need to call this before a 
+*   task exits.
+*
+*   Parameters:
+*       HANDLE handle   Handle to free.  It must belong to the current task.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the handle is not valid.
+*
+*   Example:
+*       handle_free(h);
+*
+*/
+int handle_free(HANDLE handle);
+
+/* defined in profile.c */
+/******************************************************************************
 *
+*   Print a task's heap allocations by call site.  Each line is for one call
+*   site and size class, with the blocks that are live now, the most that 
+*   were ever live at once, and the number of allocations.  The same table is
+*   printed when a task exits, where the live blocks are the ones it leaked.
+*   This only does anything if the system was built with HEAP_PROFILE.
 *
 *   Parameters:
+*       TCB *tcb        Task to print the profile of.  NULL means the current
+*                       task.
 *
 *   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if there is no profile for the task.
 *
-*   Notes:
+*   Example:
+*       task_heap_profile(NULL);
 *
 */
-TCB *check_event(UINT *type, UINT *subtype);
+int task_heap_profile(TCB *tcb);
 
+/* defined in topic.c */
 /******************************************************************************
 *
-*   Function prototypes and associated documentation.
+*   Create a topic that tasks can subscribe to.  It is allocated from the 
+*   global heap.
+*
+*   Parameters:
+*       UINT type       Event type of the notices that the subscribers get
+*                       when something is published.
+*
+*   Returns:
+*       Pointer to the topic, or NULL if there is no memory.
+*
+*   Example:
+*       mode_topic = topic_create(MODE_CHANGE_EVENT);
+*
+*/
+TOPIC *topic_create(UINT type);
+
+/******************************************************************************
 *
+*   Destroy a topic that has no subscribers.
 *
 *   Parameters:
+*       TOPIC *topic    The topic.
 *
 *   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if there are still subscribers.
 *
-*   Notes:
+*/
+int topic_destroy(TOPIC *topic);
+
+/******************************************************************************
+*
+*   Subscribe the current task to a topic.  It sees what is published from
+*   now on.  The subscription ends when the task exits.
+*
+*   Parameters:
+*       TOPIC *topic    The topic.
+*
+*   Returns:
+*       Pointer to the subscription, or NULL if there is no memory.
+*
+*   Example:
+*       sub = topic_subscribe(mode_topic);
 *
 */
-TCB *wait_event(UINT *type, UINT *subtype);
+SUBSCRIPTION *topic_subscribe(TOPIC *topic);
+
+/******************************************************************************
+*
+*   End a subscription.  Anything that it has not read is dropped.
+*
+*   Parameters:
+*       SUBSCRIPTION *sub   The subscription.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if it is not a subscription.
+*
+*/
+int topic_unsubscribe(SUBSCRIPTION *sub);
+
+/******************************************************************************
+*
+*   Publish something to every subscriber of a topic.  One record is 
+*   allocated for all of them.  A subscriber that has nothing else to read
+*   is sent an event of the topic's type.  This does not call the scheduler.
+*
+*   Parameters:
+*       TOPIC *topic    The topic.
+*
+*       UINT subtype    Whatever the tasks agree on.
+*
+*       void *data      Data for the subscribers.
+*
+*       UINT size       Number of bytes of data, up to EVENT_DATA_SIZE.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the data is too big or there is no
+*       memory.
+*
+*   Example:
+*       topic_publish(mode_topic, MODE_RUN, NULL, 0);
+*
+*/
+int topic_publish(TOPIC *topic, UINT subtype, void *data, UINT size);
+
+/******************************************************************************
+*
+*   Read the next thing that was published to a subscription.
+*
+*   Parameters:
+*       SUBSCRIPTION *sub   The subscription.
+*
+*       UINT *subtype       Set to the subtype, if it is not NULL.
+*
+*       void *data          Gets the EVENT_DATA_SIZE bytes of data, if it
+*                           is not NULL.
+*
+*   Returns:
+*       The task that published it, or NULL if there is nothing to read.
+*
+*   Example:
+*       wait_event_match(MODE_CHANGE_EVENT, NULL, NULL, NULL);
+*       while(topic_read(sub, &mode, NULL) != NULL)
+*           change_mode(mode);
+*
+*/
+TCB *topic_read(SUBSCRIPTION *sub, UINT *subtype, void *data);
+
+/* defined in wait.c */
+/******************************************************************************
+*
+*   Block the current task until any one of a set of sources is ready: an
+*   event whose type has a bit of "mask" set, a deadline from sys_time(), a
+*   file descriptor that can be read or written, or a channel that has an
+*   item to receive or room to send one.  The task is not run until one of
+*   them is ready.  The ready field of each source is set, and nothing is 
+*   taken from the sources.  If a channel is destroyed while the task waits
+*   for it, then it's source is ready and the channel field is set to NULL.
+*
+*   Parameters:
+*       WAIT_SOURCE *sources    The sources to wait for.
+*
+*       UINT count              Number of sources.
+*
+*   Returns:
+*       The index of the first source that is ready, or TASK_ERROR if a
+*       source is not valid, or if the waiting tasks would have more than
+*       WAIT_MAX_FDS file descriptors all together.
+*
+*   Example:
+*       WAIT_SOURCE src[3];
+*
+*       src[0].kind = WAIT_SOURCE_EVENT;
+*       src[0].mask = EVENT_MATCH_TYPE(MESSAGE_ARRIVAL_EVENT);
+*       src[1].kind = WAIT_SOURCE_TIMER;
+*       src[1].deadline = sys_time() + 50;
+*       src[2].kind = WAIT_SOURCE_FD;
+*       src[2].fd = serial_fd;
+*       src[2].mask = WAIT_READ;
+*       switch(task_wait_any(src, 3)) { ...
+*
+*/
+int task_wait_any(WAIT_SOURCE *sources, UINT count);
+
+/* defined in message.c */
+/******************************************************************************
+*
+*   Send a message to a task and call the scheduler.  The data is copied 
+*   into the receiver's heap, so it can be anything, and the sender can use
+*   it again as soon as this returns.
+*
+*   Parameters:
+*       TCB *tcb        The task to send the message to.
+*
+*       void *data      The data of the message.
+*
+*       UINT size       Size of the data in bytes.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if there is no memory.
+*
+*   Example:
+*       send_msg_sync(log_tcb, "sensor offline", 15);
+*
+*/
+int send_msg_sync(TCB *tcb, void *data, UINT size);
+
+/******************************************************************************
+*
+*   Send a message to a task without copying the data and call the 
+*   scheduler.  The data has to be a block that the current task got from
+*   task_alloc().  The block itself is handed to the receiver, so the sender
+*   must not touch it after this returns.  It stays in the sender's heap 
+*   until the receiver gives it back, even if the sender exits.
+*
+*   Parameters:
+*       TCB *tcb        The task to send the message to.
+*
+*       void *data      A block from task_alloc().
+*
+*       UINT size       Size of the data in bytes.  It can't be more than 
+*                       the size of the block.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the data is not a block from 
+*       task_alloc() or there is no memory.
+*
+*   Example:
+*       frame = task_alloc(FRAME_SIZE);
+*       read_sensor(frame);
+*       send_msg_buffer(filter_tcb, frame, FRAME_SIZE);
+*
+*/
+int send_msg_buffer(TCB *tcb, void *data, UINT size);
+
+/******************************************************************************
+*
+*   Wait for the next message to the current task.  A MESSAGE_ARRIVAL_EVENT
+*   is in the task's event queue while there are any.
+*
+*   Parameters:
+*       void **data     Set to the data of the message, if not NULL.  It
+*                       has to be given back with free_message_data().  It
+*                       is set to NULL for a message with no data, which
+*                       has nothing to give back.
+*
+*       int *size       Set to the size of the data, if not NULL.
+*
+*   Returns:
+*       The task that sent the message.
+*
+*   Example:
+*       sender = receive_msg_sync(&frame, &size);
+*
+*/
+TCB *receive_msg_sync(void **data, int *size);
+
+/******************************************************************************
+*
+*   Free the data of a message that the current task received.  It is free'd
+*   from the heap that it is in, which is the sender's heap if it was sent
+*   with send_msg_buffer().
+*
+*   Parameters:
+*       void *data      The data from receive_msg_sync().
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if it is not the data of a message that
+*       the task received.
+*
+*   Example:
+*       free_message_data(frame);
+*
+*/
+int free_message_data(void *data);
+
+/* defined in channel.c */
+/******************************************************************************
+*
+*   Create a channel that the current task receives fixed size items from.
+*   The ring of slots is allocated once from the task's heap, so sending and
+*   receiving do not allocate anything.  One other task sends to it.
+*
+*   Parameters:
+*       UINT slot_size  Size of an item in bytes.
+*
+*       UINT slots      Number of items that the channel holds.
+*
+*   Returns:
+*       The channel, or NULL if there is no memory.
+*
+*   Example:
+*       samples = channel_create(sizeof(SAMPLE), 64);
+*
+*/
+CHANNEL *channel_create(UINT slot_size, UINT slots);
+
+/******************************************************************************
+*
+*   Destroy a channel.  Only the task that created it can.  It is also
+*   destroyed when that task exits.
+*
+*   Parameters:
+*       CHANNEL *ch     The channel.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the current task did not create it.
+*
+*   Example:
+*       channel_destroy(samples);
+*
+*/
+int channel_destroy(CHANNEL *ch);
+
+/******************************************************************************
+*
+*   Copy an item into a channel.  If it is full, the current task is blocked
+*   until there is room.  The scheduler is not called otherwise.
+*
+*   Parameters:
+*       CHANNEL *ch     The channel.
+*
+*       void *item      slot_size bytes to send.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the channel was destroyed while the
+*       task was blocked.
+*
+*   Example:
+*       channel_send(samples, &sample);
+*
+*/
+int channel_send(CHANNEL *ch, void *item);
+
+/******************************************************************************
+*
+*   Copy the oldest item out of a channel.  If it is empty, the current task
+*   is blocked until there is one.  The scheduler is not called otherwise.
+*
+*   Parameters:
+*       CHANNEL *ch     The channel.  The current task must have created it.
+*
+*       void *item      Gets slot_size bytes.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the current task did not create the
+*       channel.
+*
+*   Example:
+*       channel_receive(samples, &sample);
+*
+*/
+int channel_receive(CHANNEL *ch, void *item);
+
+/* defined in pool.c */
+/******************************************************************************
+*
+*   Create a pool of fixed size objects in the current task's heap.  The 
+*   whole pool is allocated as a single heap block, so getting and putting
+*   objects never searches the heap.  The pool belongs to the task and is 
+*   destroyed along with the task's heap when the task dies.
+*
+*   Parameters:
+*       UINT obj_size   Size of each object in bytes.  It is rounded up to a
+*                       multiple of HEAP_GRAIN.
+*
+*       UINT count      Number of objects in the pool.
+*
+*   Returns:
+*       Pointer to the new pool, or NULL if there is not enough memory in the 
+*       task's heap.
+*
+*   Example:
+*       pool = task_pool_create(sizeof(CELL), 256);
+*
+*/
+POOL *task_pool_create(UINT obj_size, UINT count);
+
+/******************************************************************************
+*
+*   Get an object from a pool.  The object is not cleared.
+*
+*   Parameters:
+*       POOL *pool      Pool to get the object from.
+*
+*   Returns:
+*       Pointer to the object, or NULL if all of the objects are in use.
+*
+*   Example:
+*       cell = pool_get(pool);
+*
+*/
+void *pool_get(POOL *pool);
+
+/******************************************************************************
+*
+*   Put an object back into the pool that it came from.
+*
+*   Parameters:
+*       POOL *pool      Pool that the object was taken from.
+*
+*       void *obj       Object that was returned by "pool_get()".
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the object does not belong to the pool.
+*
+*   Example:
+*       pool_put(pool, cell);
+*
+*/
+int pool_put(POOL *pool, void *obj);
+
+/******************************************************************************
+*
+*   Destroy a pool, releasing all of it's objects at once.  This is only 
+*   needed if the task wants the memory back before it exits.
+*
+*   Parameters:
+*       POOL *pool      Pool to destroy.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the pool is not valid.
+*
+*   Example:
+*       pool_destroy(pool);
+*
+*/
+int pool_destroy(POOL *pool);
+
+/* defined in region.c */
+/******************************************************************************
+*
+*   Create a region in the current task's heap.  A region hands out memory by
+*   moving a pointer forward and releases all of it at once with 
+*   "region_reset()", so a task that needs scratch memory in every cycle does
+*   no work per buffer to release it.  The region belongs to the task and is
+*   destroyed along with the task's heap when the task dies.
+*
+*   Parameters:
+*       UINT size       Number of bytes that can be allocated from the region.
+*
+*   Returns:
+*       Pointer to the new region, or NULL if there is not enough memory in
+*       the task's heap.
+*
+*   Example:
+*       scratch = task_region_create(16 * 1024);
+*
+*/
+REGION *task_region_create(UINT size);
+
+/******************************************************************************
+*
+*   Allocate memory from a region.  The memory is aligned to HEAP_GRAIN, but
+*   it is not cleared.  It cannot be free'd except by "region_reset()".
+*
+*   Parameters:
+*       REGION *region  Region to allocate from.
+*
+*       UINT size       Number of bytes to allocate.
+*
+*   Returns:
+*       Pointer to the memory, or NULL if the region is full.
+*
+*   Example:
+*       buf = region_alloc(scratch, 1024);
+*
+*/
+void *region_alloc(REGION *region, UINT size);
+
+/******************************************************************************
+*
+*   Release everything that was allocated from a region at once.  Pointers
+*   that were returned by "region_alloc()" must not be used after this.
+*
+*   Parameters:
+*       REGION *region  Region to reset.
+*
+*   Returns:
+*       nothing.
+*
+*   Example:
+*       region_reset(scratch);
+*
+*/
+void region_reset(REGION *region);
+
+/******************************************************************************
+*
+*   Give a region back to the task's heap.  This is only needed if the task
+*   wants the memory back before it exits.
+*
+*   Parameters:
+*       REGION *region  Region to destroy.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the region is not valid.
+*
+*   Example:
+*       region_destroy(scratch);
+*
+*/
+int region_destroy(REGION *region);
+
+/* defined in system.c */
+/******************************************************************************
+*
+*   Function prototypes and associated documentation.
+*
+*
+*   Parameters:
+*
+*   Returns:
+*
+*   Notes:
+*
+*/
+int setup_stack_frame(TCB *tcb, void *entry);
+
+#ifndef _USE_SETJMP_
+/******************************************************************************
+*
+*   Function prototypes and associated documentation.
+*
+*
+*   Parameters:
+*
+*   Returns:
+*
+*   Notes:
+*
+*/
+int save_task_context(TASK_CONTEXT tc);
+
+/******************************************************************************
+*
+*   Function prototypes and associated documentation.
+*
+*
+*   Parameters:
+*
+*   Returns:
+*
+*   Notes:
+*
+*/
+void restore_task_context(TASK_CONTEXT tc, UINT code);
+#endif
+
+/******************************************************************************
+*
+*   Stop until something outside of the tasker needs attention.  The 
+*   scheduler calls this when no task is runnable and events can still be
+*   injected.  Under another OS, this sleeps until sys_wake() is called.
+*
+*   Parameters:
+*       none
+*
+*   Returns:
+*       nothing
+*
+*/
+void halt_processor(void);
+
+/******************************************************************************
+*
+*   Set up what sys_wake() needs.  This is called by inject_attach().
+*
+*   Parameters:
+*       none
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if it can't be done.
+*
+*/
+int sys_wake_init(void);
+
+/******************************************************************************
+*
+*   Get the time in milliseconds.  It wraps around, so compare two times by
+*   subtracting them.
+*
+*   Parameters:
+*       none
+*
+*   Returns:
+*       The time in milliseconds from some point in the past.
+*
+*   Example:
+*       timer.deadline = sys_time() + 100;
+*
+*/
+UINT sys_time(void);
+
+/******************************************************************************
+*
+*   Find out which file descriptors are ready and set the ready field of 
+*   their wait sources.  This is called by wait.c.
+*
+*   Parameters:
+*       WAIT_SOURCE **sources   The WAIT_SOURCE_FD sources to check.
+*
+*       UINT count              Number of them, up to WAIT_MAX_FDS.
+*
+*       int timeout             Milliseconds to wait for one of them to be
+*                               ready, or -1 to wait until one is.  A call
+*                               to sys_wake() also ends the wait.
+*
+*   Returns:
+*       The number of sources that are ready, or -1 on an error.
+*
+*/
+int sys_poll(WAIT_SOURCE **sources, UINT count, int timeout);
+
+/******************************************************************************
+*
+*   Make halt_processor() return.  If it is not halted, then the next call
+*   to it returns right away.  This must be safe to call from any thread and
+*   from a signal handler.
+*
+*   Parameters:
+*       none
+*
+*   Returns:
+*       nothing
+*
+*/
+void sys_wake(void);
+
+/******************************************************************************
+*
+*   Function prototypes and associated documentation.
+*
+*
+*   Parameters:
+*
+*   Returns:
+*
+*   Notes:
+*
+*/
+int sys_check_stack(TCB *tcb);
+
+/******************************************************************************
+*
+*   Get the memory that the global heap is made from.  This is called once by
+*   main() before anything else is done.  Where the platform supports it, the
+*   memory is backed by huge pages and can be faulted in and locked in RAM
+*   up front so that there are no page faults once the tasks are running.
+*   If huge pages are not available, then normal pages are used.
+*
+*   Parameters:
+*       UINT size       Size of the memory in bytes.
+*
+*       UINT flags      SYS_MEMORY_HUGE to ask for huge pages and 
+*                       SYS_MEMORY_LOCK to fault in and lock the memory.
+*
+*   Returns:
+*       Pointer to the memory, or NULL if there is none.
+*
+*   Example:
+*       memory = sys_get_memory(SYSTEM_MEMORY_SIZE, SYS_MEMORY_HUGE);
+*
+*/
+UCHAR *sys_get_memory(UINT size, UINT flags);
+
+/* defined in event.c */
+/******************************************************************************
+*
+*   Send an event to a task.  The event is put in the task's event queue and
+*   the task is made runnable if it is waiting for an event.  Then the
+*   scheduler is called.  The sender is never blocked.
+*
+*   Parameters:
+*       TCB *tcb        The task to send the event to.  NULL means the 
+*                       current task.
+*
+*       UINT type       Type and subtype of the event.  These are whatever
+*       UINT subtype    the tasks agree on.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the event could not be allocated.
+*
+*   Example:
+*       generate_event(tcb, MY_EVENT_TYPE, 0);
+*
+*/
+int generate_event(TCB *tcb, UINT type, UINT subtype);
+
+/******************************************************************************
+*
+*   Send an event to a task without calling the scheduler.  This is the same
+*   as generate_event() otherwise.  If the task that gets the event has a 
+*   higher priority than the sender, then it runs at the sender's next yield.
+*
+*   Parameters:
+*       TCB *tcb        The task to send the event to.  NULL means the 
+*                       current task.
+*
+*       UINT type       Type and subtype of the event.
+*       UINT subtype
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the event could not be allocated.
+*
+*   Example:
+*       post_event(tcb, MY_EVENT_TYPE, 0);
+*
+*/
+int post_event(TCB *tcb, UINT type, UINT subtype);
+
+/******************************************************************************
+*
+*   Send a batch of events.  They are all delivered before the scheduler is
+*   called, and it is called only once, and only if one of them woke up a 
+*   task that has a higher priority than the sender.
+*
+*   Parameters:
+*       EVENT_POST *batch   The events to send, in order.
+*
+*       UINT count          Number of events in the batch.
+*
+*   Returns:
+*       The number of events that were sent.  It is less than "count" if an
+*       event could not be allocated.
+*
+*   Example:
+*       EVENT_POST batch[2] = {{tcb, READING_EVENT, 0}, {tcb, READING_EVENT, 1}};
+*       post_events(batch, 2);
+*
+*/
+int post_events(EVENT_POST *batch, UINT count);
+
+/******************************************************************************
+*
+*   Send an event to a task from outside of the tasker, such as from another
+*   thread or a signal handler.  It does not lock or allocate, and the event
+*   is delivered the next time that the scheduler runs.  The sender that the
+*   task sees is NULL.
+*
+*   Parameters:
+*       TCB *tcb        The task to send the event to.  It can't be NULL,
+*                       and the task must not exit before the event is 
+*                       delivered.
+*
+*       UINT type       Type and subtype of the event.
+*       UINT subtype
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the ring of EVENT_INJECT_SIZE events 
+*       is full.
+*
+*   Example:
+*       void sigio_handler(int sig) {
+*           inject_event(io_task, IO_READY_EVENT, sig);
+*       }
+*
+*/
+int inject_event(TCB *tcb, UINT type, UINT subtype);
+
+/******************************************************************************
+*
+*   Tell the scheduler that events may be injected, or that they won't be
+*   any more.  While anything is attached, the scheduler halts the processor
+*   when no task is runnable, rather than returning, and inject_event() wakes
+*   it up.  Call inject_attach() before starting the thread or installing the
+*   handler.
+*
+*   Parameters:
+*       none
+*
+*   Returns:
+*       The number of injected events that were dropped so far because the
+*       ring was full.
+*
+*   Example:
+*       inject_attach();
+*       pthread_create(&thread, NULL, driver_thread, io_task);
+*
+*/
+UINT inject_attach(void);
+UINT inject_detach(void);
+
+/******************************************************************************
+*
+*   Send an event to a task by way of the event task.  The event is delivered
+*   the next time that the event task runs.  This does not call the scheduler
+*   and does not touch the destination task, so it can be used where 
+*   generate_event() can't.
+*
+*   Parameters:
+*       TCB *tcb        The task to send the event to.  NULL means the 
+*                       current task.
+*
+*       UINT type       Type and subtype of the event.
+*       UINT subtype
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the event could not be allocated.
+*
+*   Example:
+*       defer_event(tcb, MY_EVENT_TYPE, 0);
+*
+*/
+int defer_event(TCB *tcb, UINT type, UINT subtype);
+
+/******************************************************************************
+*
+*   Send an event with some data to a task, without calling the scheduler.
+*   The receiver gets the data with wait_event_match().
+*
+*   Parameters:
+*       TCB *tcb        The task to send the event to.  NULL means the 
+*                       current task.
+*
+*       UINT type       Type and subtype of the event.
+*       UINT subtype
+*
+*       void *data      Data to copy into the event.
+*
+*       UINT size       Number of bytes of data, up to EVENT_DATA_SIZE.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the data is too big or the event could
+*       not be allocated.
+*
+*   Example:
+*       post_event_data(tcb, READING_EVENT, channel, &value, sizeof(value));
+*
+*/
+int post_event_data(TCB *tcb, UINT type, UINT subtype, void *data, UINT size);
+
+/******************************************************************************
+*
+*   Send an event in a priority band, without calling the scheduler.  It is
+*   received before the events in less urgent bands that are already in the
+*   queue.  post_event() uses EVENT_BAND_NORMAL.
+*
+*   Parameters:
+*       TCB *tcb        The task to send the event to.  NULL means the
+*                       current task.
+*
+*       UINT type       Type and subtype of the event.
+*       UINT subtype
+*
+*       UINT band       EVENT_BAND_URGENT, EVENT_BAND_HIGH, EVENT_BAND_NORMAL
+*                       or EVENT_BAND_LOW.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the band is not valid or the event
+*       could not be allocated.
+*
+*   Example:
+*       post_event_priority(motor, STOP_EVENT, 0, EVENT_BAND_URGENT);
+*
+*/
+int post_event_priority(TCB *tcb, UINT type, UINT subtype, UINT band);
+
+/******************************************************************************
+*
+*   Take the next event from the current task's queue, if there is one.  The
+*   scheduler is called either way.
+*
+*   Parameters:
+*       UINT *type      Set to the type and subtype of the event.  The type
+*       UINT *subtype   is set to 0 if there was no event.
+*
+*   Returns:
+*       The task that sent the event, or NULL if there was no event.
+*
+*   Example:
+*       if((sender = check_event(&type, &subtype)) != NULL)
+*           handle_event(sender, type, subtype);
+*
+*/
+TCB *check_event(UINT *type, UINT *subtype);
+
+/******************************************************************************
+*
+*   Wait for the next event in the current task's queue and take it.
+*
+*   Parameters:
+*       UINT *type      Set to the type and subtype of the event.
+*       UINT *subtype
+*
+*   Returns:
+*       The task that sent the event.
+*
+*   Example:
+*       sender = wait_event(&type, &subtype);
+*
+*/
+TCB *wait_event(UINT *type, UINT *subtype);
+
+/******************************************************************************
+*
+*   Wait for the next event whose type has any of the bits of a mask set.
+*   Events that do not match stay in the queue and do not wake the task up.
+*
+*   Parameters:
+*       UINT mask       Type mask.  EVENT_MATCH_ANY matches all events and
+*                       EVENT_MATCH_SYSTEM all of the system events.  An
+*                       event matches if it's type has any of the bits of
+*                       the mask set, so types that are small numbers match
+*                       each other.  EVENT_MATCH_TYPE(type) only matches
+*                       that one type.
+*
+*       UINT *type      Set to the type and subtype of the event, if they 
+*       UINT *subtype   are not NULL.
+*
+*       void *data      Gets the EVENT_DATA_SIZE bytes of data of the event,
+*                       if it is not NULL.
+*
+*   Returns:
+*       The task that sent the event.
+*
+*   Example:
+*       sender = wait_event_match(EVENT_MATCH_SYSTEM, &type, NULL, NULL);
+*
+*/
+TCB *wait_event_match(UINT mask, UINT *type, UINT *subtype, void *data);
+
+/******************************************************************************
+*
+*   Take up to "max" events from the current task's queue at once, if there
+*   are any.  The scheduler is called once, however many there are.
+*
+*   Parameters:
+*       EVENT_INFO *buf Gets the sender, type, subtype and data of each
+*                       event, in the order that wait_event() returns them.
+*
+*       UINT max        Number of entries in buf.
+*
+*   Returns:
+*       The number of events, 0 if there were none, or TASK_ERROR if buf is
+*       NULL or max is 0.
+*
+*   Example:
+*       count = check_events(events, 32);
+*
+*/
+int check_events(EVENT_INFO *buf, UINT max);
+
+/******************************************************************************
+*
+*   Wait for at least one event in the current task's queue, then take up
+*   to "max" of them at once.  The scheduler is only called while waiting.
+*
+*   Parameters:
+*       EVENT_INFO *buf Gets the sender, type, subtype and data of each
+*                       event, in the order that wait_event() returns them.
+*
+*       UINT max        Number of entries in buf.
+*
+*   Returns:
+*       The number of events, at least 1, or TASK_ERROR if buf is NULL or
+*       max is 0.
+*
+*   Example:
+*       count = wait_events(events, 32);
+*       for(idx = 0; idx < count; idx++)
+*           handle_event(events[idx].sender, events[idx].type);
+*
+*/
+int wait_events(EVENT_INFO *buf, UINT max);
+
+/******************************************************************************
+*
+*   Count the events in a task's queue whose type has any of the bits of a
+*   mask set.  The events are left in the queue.
+*
+*   Parameters:
+*       TCB *tcb        The task.  NULL means the current task.
+*
+*       UINT mask       Type mask, as for wait_event_match().
+*
+*   Returns:
+*       The number of events that match.
+*
+*   Example:
+*       if(event_pending(NULL, EVENT_MATCH_SYSTEM))
+*           sender = wait_event_match(EVENT_MATCH_SYSTEM, &type, NULL, NULL);
+*
+*/
+UINT event_pending(TCB *tcb, UINT mask);
+
+/******************************************************************************
+*
+*   Coalesce the events of a type and subtype that are sent to the current
+*   task.  While one of them is in the queue, the ones that come after it 
+*   are merged into it: the newest sender and data replace the old ones, and
+*   the queue does not grow.
+*
+*   Parameters:
+*       UINT type       Type and subtype of the events.
+*       UINT subtype
+*
+*       int on          Non-zero to coalesce them, zero to stop.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the task already coalesces
+*       EVENT_COALESCE_KEYS kinds of events or there is no memory.
+*
+*   Example:
+*       event_coalesce(SAMPLE_EVENT, LIDAR, 1);
+*
+*/
+int event_coalesce(UINT type, UINT subtype, int on);
+
+/******************************************************************************
+*
+*   Set the most events that a task's queue holds, and what happens to an
+*   event that is sent when it is full.  Every queue starts out holding 
+*   DEFAULT_EVENT_LIMIT events with the EVENT_QUEUE_FAIL policy.
+*
+*   Parameters:
+*       TCB *tcb        The task.  NULL means the current task.
+*
+*       UINT limit      Most events in the queue, or 0 for no limit.
+*
+*       UINT policy     EVENT_QUEUE_FAIL        the sender gets TASK_ERROR
+*                       EVENT_QUEUE_BLOCK       the sender waits for room
+*                       EVENT_QUEUE_DROP_NEWEST the new event is dropped
+*                       EVENT_QUEUE_DROP_OLDEST the oldest one is dropped
+*
+*                       Message and topic notices are never dropped, so
+*                       the task is always told about what is waiting.
+*
+*   Returns:
+*       TASK_SUCCESS, or TASK_ERROR if the policy is not valid.
+*
+*   Example:
+*       event_queue_limit(NULL, 32, EVENT_QUEUE_DROP_OLDEST);
+*
+*/
+int event_queue_limit(TCB *tcb, UINT limit, UINT policy);
+
+/******************************************************************************
+*
+*   Get the depth, peak depth, number of dropped or refused events, limit
+*   and policy of a task's event queue.
+*
+*   Parameters:
+*       TCB *tcb                    The task.  NULL means the current task.
+*
+*       EVENT_QUEUE_STATS *stats    Filled in with the statistics.
+*
+*   Returns:
+*       TASK_SUCCESS or TASK_ERROR.
+*
+*/
+int event_queue_stats(TCB *tcb, EVENT_QUEUE_STATS *stats);
 
 #endif  /* __PROTO_HEADER_DEFINED__ */
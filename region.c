@@ -0,0 +1,101 @@
+/******************************************************************************
+*
+*   Regions (frame allocators).
+*
+*     A region is a single block that is allocated from the task's heap.
+*   Memory is allocated from it by moving a pointer forward, and it is all
+*   released at once by moving the pointer back to the start.  Nothing is
+*   ever free'd one at a time.
+*
+*     This is meant for tasks that run in cycles and need scratch memory in
+*   each cycle.  The scratch buffers are allocated from the region during
+*   the cycle, and "region_reset()" is called at the end of it.  The cost of
+*   a cycle is then the same no matter how many buffers were used.
+*
+*     Since the whole region is one heap block, it goes away with the rest
+*   of the task's heap when the task is killed or returns.
+*
+*/
+#include "kern.h"
+
+/******************************************************************************
+*
+*   Create a region of "size" bytes in the current task's heap.  Return a
+*   pointer to the region, or NULL if there is not enough memory in the heap.
+*
+*/
+REGION *task_region_create(UINT size) {
+
+    REGION *region;
+    UINT total;
+
+    size = HEAP_ROUND(size);
+    total = HEAP_ROUND(sizeof(REGION)) + size;
+    if(size == 0 || total < size)
+        return NULL;
+
+    if((region = task_alloc(total)) == NULL)
+        return NULL;
+
+    region->size = size;
+    region->used = 0;
+    region->high_water = 0;
+    region->owner = get_current_task_tcb();
+    region->base = (UCHAR *)region + HEAP_ROUND(sizeof(REGION));
+
+    return region;
+}
+
+
+/******************************************************************************
+*
+*   Allocate "size" bytes from the region.  The memory is aligned to the heap
+*   grain but it is not cleared.  Return NULL if the region is full.
+*
+*/
+void *region_alloc(REGION *region, UINT size) {
+
+    UINT need;
+    void *ptr;
+
+    if(region == NULL)
+        return NULL;
+
+    need = HEAP_ROUND(size);
+    if(need < size || need > region->size - region->used)
+        return NULL;
+
+    ptr = region->base + region->used;
+    region->used += need;
+    if(region->used > region->high_water)
+        region->high_water = region->used;
+
+    return ptr;
+}
+
+
+/******************************************************************************
+*
+*   Release everything that was allocated from the region.
+*
+*/
+void region_reset(REGION *region) {
+
+    if(region != NULL)
+        region->used = 0;
+}
+
+
+/******************************************************************************
+*
+*   Give the region back to the heap of the task that created it.  There is
+*   no need to call this before a task exits.
+*
+*/
+int region_destroy(REGION *region) {
+
+    if(region == NULL)
+        return TASK_ERROR;
+
+    return tcb_free(region->owner, region)? TASK_ERROR: TASK_SUCCESS;
+}
@@ -21,6 +21,7 @@
 
 #if ! __RUN_AS_KERNEL__
 #include <stdio.h>
+#include <stdlib.h>
 #endif
 
 #include "kern.h"
@@ -36,6 +37,14 @@ static TCB *current_task;
 static jmp_buf sched_context;
 static UINT task_number = 0;
 static UCHAR task_crit_flag = 0;
+/*  A task with holes in it's heap that handles can be moved into */
+static TCB *compact_task = NULL;
+#if HEAP_VERIFY_NODES > 0
+/*  Where the background heap check is, and the first error that it found */
+static TCB *verify_task = NULL;
+static UINT verify_extent = 0;
+static HEAP_CHECK heap_check = {0, 0, 0, 0};
+#endif
 
 /*  Functions that are used only by this module */
 static void task_queue_add(TCB *tcb);
@@ -45,6 +54,12 @@ static void scheduler(void);
 static void system_yield(int code);
 static inline UCHAR get_sched_priority(void);
 static inline TCB *delete_task(TCB *tcb);
+#if HEAP_VERIFY_NODES > 0
+static void verify_heaps(void);
+#endif
+#if ! __RUN_AS_KERNEL__
+static void get_memory_options(UINT *size, UINT *flags);
+#endif
 
 /* defined in user application */
 extern void task_main(CMDLINE *cl);
@@ -52,6 +67,18 @@ extern void task_main(CMDLINE *cl);
 /*  private function defined in another module */
 extern int init_global_heap(UCHAR *start, UINT size);
 extern int init_event_system(void);
+extern void free_task_heap(TCB *tcb);
+extern void free_task_handles(TCB *tcb);
+extern void free_task_events(TCB *tcb);
+extern int drain_injected_events(void);
+extern int wake_waiters(int idle);
+extern void free_task_waits(TCB *tcb);
+extern void free_task_subscriptions(TCB *tcb);
+extern void free_task_messages(TCB *tcb);
+extern void free_task_channels(TCB *tcb);
+#ifdef HEAP_PROFILE
+extern void free_task_profile(TCB *tcb);
+#endif
 
 /******************************************************************************
 *
@@ -70,26 +97,38 @@ extern int init_event_system(void);
 *   initializes the entire tasker system.  Other initialization needed by
 *   the user's application should be done in the task_main() funciton.
 *
+*   The global heap is made from SYSTEM_MEMORY_SIZE bytes that are gotten
+*   from the system with the SYSTEM_MEMORY_FLAGS.  When running under another
+*   OS, these can be changed with environment variables:
+*
+*       SROS_MEMORY_SIZE    Size of the global heap in bytes.  A suffix of K,
+*                           M or G multiplies it.  (i.e. SROS_MEMORY_SIZE=64M)
+*       SROS_MEMORY_HUGE    Set to 0 to use normal pages instead of huge ones.
+*       SROS_MEMORY_LOCK    Set to 1 to fault in the whole heap and lock it in 
+*                           RAM before any task runs.
+*
 */
 int main(int argc, char **argv) {
 
     static CMDLINE args;    /* persistant pointer */
     TCB *tcb;
+    UCHAR *memory;
+    UINT memory_size = SYSTEM_MEMORY_SIZE;
+    UINT memory_flags = SYSTEM_MEMORY_FLAGS;
 
 #if !__RUN_AS_KERNEL__
-    /* Test code allocates 2 meg for system memory */
-    UCHAR *SYSTEM_MEMORY;
-    UINT SYSTEM_MEMORY_SIZE = 2 * 1024 * 1024;
-    extern void *malloc(unsigned int size);
-    if((SYSTEM_MEMORY = malloc(SYSTEM_MEMORY_SIZE)) == NULL) {
-        return TASK_ERROR;
-    }
+    get_memory_options(&memory_size, &memory_flags);
     printf("main = 0x%08X\n", (UINT)main);
 #endif
 
+    /* Get the memory for the global heap from the system. */
+    if((memory = sys_get_memory(memory_size, memory_flags)) == NULL) {
+        return TASK_ERROR;
+    }
+
     /* Init the global heap from system constants.  This _MUST_ be called
         before any of the other tasker funcitons that use memory. */
-    if(init_global_heap(SYSTEM_MEMORY, SYSTEM_MEMORY_SIZE) != TASK_SUCCESS) {
+    if(init_global_heap(memory, memory_size) != TASK_SUCCESS) {
         return TASK_ERROR;  /* this suould never really fail.... */
     }
 
@@ -168,6 +207,9 @@ TCB *task_create(void *entry,
     /*  we now have a pointer and a size, so init the task's heap */
     if((tcb->heap = init_heap(heap_tmp, hsize)) == NULL) 
         goto handle_error;
+    /*  The heap can grow up to the limit by adding extents to it. */
+    tcb->hsize = tcb->heap->size;
+    tcb->hlimit = (hsize > DEFAULT_HEAP_LIMIT)? hsize: DEFAULT_HEAP_LIMIT;
 
     /*  Set up the stack from the task's heap*/
     if((tcb->stack = tcb_alloc(tcb, stksize)) == NULL) 
@@ -176,6 +218,17 @@ TCB *task_create(void *entry,
     /*  Note that events are always allocated on the global heap */
     if((tcb->event_queue = tcb_alloc(tcb, sizeof(EVENT_QUEUE))) == NULL)
         goto handle_error;
+    tcb->event_queue->limit = DEFAULT_EVENT_LIMIT;
+    tcb->event_queue->policy = EVENT_QUEUE_FAIL;
+
+    /*  The task is told about messages with an event that is part of the 
+        message queue, see message.c */
+    if((tcb->message_queue = tcb_alloc(tcb, sizeof(MESSAGE_QUEUE))) == NULL)
+        goto handle_error;
+    tcb->message_queue->notice.type = MESSAGE_ARRIVAL_EVENT;
+    tcb->message_queue->notice.destination = tcb;
+    tcb->message_queue->notice.flags = EVENT_STATIC;
+    tcb->message_queue->notice.band = EVENT_BAND_NORMAL;
 
     /*  Do some initshit */
     tcb->ssize = stksize;
@@ -207,10 +260,15 @@ TCB *task_create(void *entry,
 
 /*  Local GOTO destination for error handling */
 handle_error:
+#ifdef HEAP_PROFILE
+    if(tcb != NULL && tcb->profile != NULL) global_free(tcb->profile);
+#endif
+    /* If the heap was allocate successfully, then free it, along with any 
+        extents that it grew. */
+    if(tcb != NULL && tcb->heap != NULL)    free_task_heap(tcb);
+    else if(heap_tmp != NULL)               global_free(heap_tmp);
     /* If the tcb was allocate successfully, then free it. */
     if(tcb != NULL)         global_free(tcb);
-    /* If the heap was allocate successfully, then free it. */
-    if(heap_tmp != NULL)    global_free(heap_tmp);
     /*  there is no need to free the stack upon error because it gets free()d 
         as a block inside the heap.  No further house keeping is required. */        
     return NULL;
@@ -356,14 +414,47 @@ void yield(void) {
 */
 void free_task_resources(TCB *tcb) {
 
-    /*  Free the TCB's heap.  No need to free the stack and such because the
-        whole task heap is being destroyed. */
-    global_free(tcb->heap);
+#ifdef HEAP_PROFILE
+    /*  Report what the task left behind before it is all thrown away. */
+    free_task_profile(tcb);
+#endif
+
+    /*  Free the TCB's heap and any extents it grew.  No need to free the 
+        stack and such because the whole task heap is being destroyed. */
+    free_task_waits(tcb);
+    free_task_events(tcb);
+    free_task_subscriptions(tcb);
+    free_task_messages(tcb);
+    free_task_channels(tcb);
+    free_task_handles(tcb);
+    free_task_heap(tcb);
     /* Free the TCB from the global heap */
     global_free(tcb);
 }
 
 
+/******************************************************************************
+*
+*   Find out whether the background heap check has found a corrupt task heap.
+*   If it has, then fill in "report" with the task that owns the heap and the
+*   offset of the first bad block, and return TASK_ERROR.  Otherwise return 
+*   TASK_SUCCESS.
+*/
+int task_heap_check(HEAP_CHECK *report) {
+
+#if HEAP_VERIFY_NODES > 0
+    if(heap_check.error == 0)
+        return TASK_SUCCESS;
+
+    if(report != NULL)
+        *report = heap_check;
+    return TASK_ERROR;
+#else
+    return TASK_SUCCESS;
+#endif
+}
+
+
 /******************************************************************************
 *
 *   Start the task critical area.  This function has the effect of preventing
@@ -473,10 +564,27 @@ static void scheduler(void) {
     UCHAR current_priority;
     TCB *tcb;
     UINT retv;
+    int injecting, waiting;
     
     while(1) {    
+        /*  Deliver the events from other threads and signal handlers, and
+            wake up the tasks whose timers or file descriptors are ready. */
+        injecting = drain_injected_events();
+        waiting = wake_waiters(0);
+
         /*  If this is true, then there are no tasks that are runnable. */
         if((current_priority = get_sched_priority()) == TASK_KILLED) {
+
+            /*  Something outside of the tasker can still make a task 
+                runnable, so wait for it.  */
+            if(waiting && task_queue.first != NULL) {
+                wake_waiters(1);
+                continue;
+            }
+            if(injecting && task_queue.first != NULL) {
+                halt_processor();
+                continue;
+            }
         
 /*  TODO: Fix this so that the __QUIT_NO_RUNABLE__ variable works.  See the
     comment above where it talks about system dependant responces to not having
@@ -484,6 +592,17 @@ static void scheduler(void) {
     
             return;
         }
+
+#if HEAP_VERIFY_NODES > 0
+        /*  Check a few more blocks of the task heaps every time through. */
+        verify_heaps();
+#endif
+
+        /*  Close up the holes in one task heap that has handles.  */
+        if(compact_task != NULL) {
+            task_heap_compact(compact_task);
+            compact_task = NULL;
+        }
         
         /*  When we reach here, it is certain that there is a runable task, 
             so find it. */
@@ -550,6 +669,7 @@ static inline UCHAR get_sched_priority(void) {
     TCB *tcb;
     UCHAR priority = 0xFF;
     
+    compact_task = NULL;
     for(tcb = task_queue.first; tcb != NULL; tcb = tcb->tnext) {
     
         /*  Delete all of the killed tasks */
@@ -562,6 +682,10 @@ static inline UCHAR get_sched_priority(void) {
         /*  Update the priority.  Find the lowest value. (highest priority) */ 
         if(tcb->status == 0 && (priority > tcb->priority))
             priority = tcb->priority;
+
+        /*  Remember a task whose heap should be compacted */
+        if(TESTFLAG(tcb->flags, TASK_COMPACT))
+            compact_task = tcb;
     }
     
     /*  Return the priority that the scheduler should schedule.  */
@@ -584,6 +708,14 @@ static inline TCB *delete_task(TCB *tcb) {
         return NULL;
     }
             
+#if HEAP_VERIFY_NODES > 0
+    /* the heap check moves on to the next task */
+    if(verify_task == tcb) {
+        verify_task = tcb->tnext;
+        verify_extent = 0;
+    }
+#endif
+
     /* delete the TCB from the list */            
     task_queue_del(tcb);
                 
@@ -594,6 +726,64 @@ static inline TCB *delete_task(TCB *tcb) {
 }
 
 
+#if HEAP_VERIFY_NODES > 0
+/******************************************************************************
+*
+*   Check the next HEAP_VERIFY_NODES blocks of the task heaps.  The check 
+*   goes through every extent of every task in the task queue, and then 
+*   starts over.  Heaps that have been found to be corrupt are skipped.  The
+*   first error that is found is kept for task_heap_check().
+*/
+static void verify_heaps(void) {
+
+    HEAP *h;
+    UINT idx, passes, offset = 0;
+    int retv;
+
+    if(verify_task == NULL) {
+        if((verify_task = task_queue.first) == NULL)
+            return;
+        verify_extent = 0;
+    }
+
+    /*  Extents come and go, so find it by it's place in the list */
+    for(h = verify_task->heap, idx = 0; 
+                h != NULL && idx < verify_extent; 
+                h = h->next, idx++)
+        ;
+
+    if(h == NULL) {
+        /*  done with this task */
+        verify_task = verify_task->tnext;
+        verify_extent = 0;
+        return;
+    }
+
+    if(TESTFLAG(h->flags, HEAP_CORRUPT)) {
+        verify_extent++;
+        return;
+    }
+
+    passes = h->passes;
+    if((retv = heap_verify_step(h, HEAP_VERIFY_NODES, &offset)) != 0) {
+        if(heap_check.error == 0) {
+            heap_check.task_number = verify_task->task_number;
+            heap_check.extent = verify_extent;
+            heap_check.offset = offset;
+            heap_check.error = retv;
+        }
+#if ! __RUN_AS_KERNEL__
+        printf("heap check: task %u extent %u: error %d at offset %u\n",
+                verify_task->task_number, verify_extent, retv, offset);
+#endif
+    }
+
+    if(retv != 0 || h->passes != passes)
+        verify_extent++;
+}
+#endif
+
+
 /******************************************************************************
 *
 *   This is the entry address for starting tasks.  
@@ -684,6 +874,45 @@ static int task_queue_del(TCB *tcb) {
 }
 
 
+#if ! __RUN_AS_KERNEL__
+/******************************************************************************
+*
+*   Read the size and flags of the system memory from the environment.  Any
+*   variable that is not set leaves the compiled in value alone.
+*/
+static void get_memory_options(UINT *size, UINT *flags) {
+
+    char *env, *end;
+    unsigned long val;
+
+    if((env = getenv("SROS_MEMORY_SIZE")) != NULL) {
+        val = strtoul(env, &end, 0);
+        switch(*end) {
+            case 'g': case 'G': val *= 1024;    /* fall through */
+            case 'm': case 'M': val *= 1024;    /* fall through */
+            case 'k': case 'K': val *= 1024;
+        }
+        if(val >= HEAP_MIN_SIZE && val <= (UINT)-1)
+            *size = (UINT)val;
+    }
+
+    if((env = getenv("SROS_MEMORY_HUGE")) != NULL) {
+        if(*env == '0')
+            CLEARFLAG(*flags, SYS_MEMORY_HUGE);
+        else
+            SETFLAG(*flags, SYS_MEMORY_HUGE);
+    }
+
+    if((env = getenv("SROS_MEMORY_LOCK")) != NULL) {
+        if(*env == '0')
+            CLEARFLAG(*flags, SYS_MEMORY_LOCK);
+        else
+            SETFLAG(*flags, SYS_MEMORY_LOCK);
+    }
+}
+#endif
+
+
 #ifndef __RUN_AS_KERNEL__
 /******************************************************************************
 *   Function used to test the list.  No other use that I know of..... 
@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <setjmp.h>
+#include <pthread.h>
 
 #include "../kern.h"
 
@@ -13,6 +14,7 @@ void task2(char *str);
 void task3(char *str);
 int event_task(void);
 void check_stack_info(int a, int b);
+void *driver_thread(void *arg);
 extern HEAP *global_heap;
 TCB *event_tcb;
 
@@ -20,6 +22,7 @@ void task_main(CMDLINE *cl) {
 
     int i, finished = 0;
     TCB *tcb;
+    pthread_t driver;
 
     printf("task_main()!\n");
     for(i = 0; i < cl->argc; i++) {
@@ -54,6 +57,10 @@ void task_main(CMDLINE *cl) {
         printf("cannot allocate task 4\n");
     }
 
+    /* an event from a thread that is not a task */
+    inject_attach();
+    pthread_create(&driver, NULL, driver_thread, event_tcb);
+
     i = 0;
     while(!finished) {
         printf("mtask: stk = %d\n", sys_check_stack(NULL));
@@ -63,9 +70,20 @@ void task_main(CMDLINE *cl) {
             finished++;
     }
     
+    pthread_join(driver, NULL);
+    yield();
+    inject_detach();
     generate_event(event_tcb, -1, -1);
 }
 
+void *driver_thread(void *arg) {
+
+    if(inject_event((TCB *)arg, 5, 500) != TASK_SUCCESS)
+        printf("driver: FAIL: cannot inject an event\n");
+
+    return NULL;
+}
+
 void task1(char *str) {
 
     int i = 0;
@@ -81,6 +99,7 @@ void task1(char *str) {
             sys_check_stack(tcb));
     
         generate_event(event_tcb, 1, 100);
+        post_event_data(event_tcb, 1, 101, &i, sizeof(i));
         if(i >= 2)
             break;
         //show_run_queue();
@@ -94,6 +113,7 @@ void task2(char *str) {
 
     int i = 0;
     TCB *tcb;
+    WAIT_SOURCE src[2];
 
     tcb = get_current_task_tcb();
     while(1) {
@@ -110,6 +130,15 @@ void task2(char *str) {
         //show_run_queue();
         yield();
     }
+
+    /* nothing sends this type, so the timer has to end the wait */
+    src[0].kind = WAIT_SOURCE_EVENT;
+    src[0].mask = 0x4000;
+    src[1].kind = WAIT_SOURCE_TIMER;
+    src[1].deadline = sys_time() + 10;
+    if(task_wait_any(src, 2) != 1)
+        printf("task 2: FAIL: the timer did not end the wait\n");
+
     printf("task 2 returning\n");
 }
 
@@ -117,6 +146,69 @@ void task3(char *str) {
 
     int i = 0;
     TCB *tcb;
+    EVENT_POST batch[2];
+    TOPIC *topic;
+    SUBSCRIPTION *sub;
+    UINT subtype;
+    EVENT_QUEUE_STATS stats;
+    EVENT_INFO events[8];
+
+    /* one record for every subscriber, read in order */
+    topic = topic_create(0x2000);
+    sub = topic_subscribe(topic);
+    topic_publish(topic, 1, NULL, 0);
+    topic_publish(topic, 2, NULL, 0);
+    if(event_pending(NULL, 0x2000) != 1)
+        printf("T3: FAIL: expected one notice\n");
+    for(i = 1; topic_read(sub, &subtype, NULL) != NULL; i++) {
+        if(subtype != i)
+            printf("T3: FAIL: read %u, expected %d\n", subtype, i);
+    }
+    topic_unsubscribe(sub);
+    topic_destroy(topic);
+
+    /* a burst of samples is one event */
+    event_coalesce(0x2000, 5, 1);
+    for(i = 0; i < 20; i++)
+        post_event(NULL, 0x2000, 5);
+    if(event_pending(NULL, 0x2000) != 1)
+        printf("T3: FAIL: the samples were not coalesced\n");
+    wait_event_match(0x2000, NULL, NULL, NULL);
+
+    /* a small queue that keeps the newest events */
+    event_queue_limit(NULL, 4, EVENT_QUEUE_DROP_OLDEST);
+    for(i = 0; i < 10; i++)
+        post_event(NULL, 0x2000, i);
+    event_queue_stats(NULL, &stats);
+    printf("T3: queue depth %u, peak %u, %u dropped\n", stats.depth,
+            stats.peak, stats.drops);
+    while(event_pending(NULL, 0x2000))
+        wait_event_match(0x2000, NULL, NULL, NULL);
+    event_queue_limit(NULL, DEFAULT_EVENT_LIMIT, EVENT_QUEUE_FAIL);
+
+    /* an urgent event goes ahead of the routine ones */
+    for(i = 0; i < 10; i++)
+        post_event(NULL, 0x2000, i);
+    post_event_priority(NULL, 0x2000, 99, EVENT_BAND_URGENT);
+    wait_event_match(0x2000, NULL, &subtype, NULL);
+    if(subtype != 99)
+        printf("T3: FAIL: got %u before the urgent event\n", subtype);
+    while(event_pending(NULL, 0x2000))
+        wait_event_match(0x2000, NULL, NULL, NULL);
+
+    /* a backlog is taken in batches */
+    for(i = 0; i < 10; i++)
+        post_event(NULL, 0x2000, i);
+    i = check_events(events, 8);
+    i += wait_events(events, 8);
+    if(i != 10 || events[1].subtype != 9)
+        printf("T3: FAIL: took %d events in two batches\n", i);
+    i = 0;
+
+    batch[0].destination = batch[1].destination = event_tcb;
+    batch[0].type = batch[1].type = 3;
+    batch[0].subtype = 301;
+    batch[1].subtype = 302;
 
     tcb = get_current_task_tcb();
     while(1) {
@@ -130,6 +222,10 @@ void task3(char *str) {
         //raise_signal(NULL, SIGNAL_KILL);
         
         generate_event(event_tcb, 3, 300);
+
+        /* a few at once, with one switch at most */
+        post_event(event_tcb, 3, 303);
+        post_events(batch, 2);
         if(i >= 7)
             break;
         //show_run_queue();
@@ -141,13 +237,15 @@ void task3(char *str) {
 int event_task(void) {
 
     int type, stype;
+    int data[EVENT_DATA_SIZE / sizeof(int)];
     TCB *tcb, *etcb;
 
     printf("event receiver started\n");
     tcb = get_current_task_tcb();
     while(1) {
-        etcb = wait_event(&type, &stype);
-        printf("Event from 0x%08X: %d:%d\n", (UINT)etcb, type, stype);
+        etcb = wait_event_match(EVENT_MATCH_ANY, &type, &stype, data);
+        printf("Event from 0x%08X: %d:%d:%d\n", (UINT)etcb, type, stype, 
+                data[0]);
         if(type == -1)
             break;
     }
@@ -0,0 +1,228 @@
+/*
+*   test the heap stuff
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "../kern.h"
+
+void task1(char *str);
+void task2(char *str);
+void task3(char *str);
+void check_alignment(char *name, void *ptr, UINT align);
+void print_stats(char *name, HEAP_STATS *stats);
+
+void task_main(CMDLINE *cl) {
+
+    TCB *tcb;
+    HEAP_STATS stats;
+
+    printf("task_main()!\n");
+
+    if((tcb = task_create(task1, "task1",
+                DEFAULT_STACK_SIZE,
+                DEFAULT_HEAP_SIZE * 4,
+                50)) == NULL) {
+        printf("cannot allocate task 1\n");
+    }
+
+    if((tcb = task_create(task2, "task2",
+                DEFAULT_STACK_SIZE,
+                DEFAULT_HEAP_SIZE * 2,
+                51)) == NULL) {
+        printf("cannot allocate task 2\n");
+    }
+
+    if((tcb = task_create(task3, "task3",
+                DEFAULT_STACK_SIZE,
+                DEFAULT_HEAP_SIZE,
+                52)) == NULL) {
+        printf("cannot allocate task 3\n");
+    }
+    task_set_heap_limit(tcb, DEFAULT_HEAP_SIZE * 4);
+
+    yield();
+
+    if(global_heap_stats(&stats) == TASK_SUCCESS)
+        print_stats("global", &stats);
+}
+
+void task1(char *str) {
+
+    void *a, *b, *c;
+    UINT align;
+    HEAP_STATS before, after;
+
+    printf("%s: heap_walk = %d\n", str, heap_walk(get_current_task_tcb()->heap));
+
+    /* every power of two up to a cache line */
+    for(align = 1; align <= HEAP_ALIGN_CACHE; align <<= 1) {
+        a = task_alloc(3);
+        b = task_alloc_aligned(align * 2 + 1, align);
+        check_alignment("task", b, align);
+        task_free(a);
+        task_free(b);
+    }
+
+    /* the padding must come back when the blocks are free'd */
+    task_heap_stats(NULL, &before);
+    a = task_alloc_aligned(100, HEAP_ALIGN_SIMD);
+    b = task_alloc_aligned(100, HEAP_ALIGN_CACHE);
+    c = task_alloc_aligned(100, HEAP_ALIGN_PAGE);
+    check_alignment("task", a, HEAP_ALIGN_SIMD);
+    check_alignment("task", b, HEAP_ALIGN_CACHE);
+    check_alignment("task", c, HEAP_ALIGN_PAGE);
+    task_free(b);
+    task_free(a);
+    task_free(c);
+    printf("%s: heap_walk = %d\n", str, heap_walk(get_current_task_tcb()->heap));
+
+    /* the heap can grow, so look at the free space rather than trying to
+        allocate it */
+    task_heap_stats(NULL, &after);
+    if(after.size != before.size || after.free != before.free ||
+                after.free_blocks != before.free_blocks)
+        printf("%s: FAIL: padding was not reclaimed\n", str);
+
+    /* global heap */
+    a = global_alloc_aligned(64, HEAP_ALIGN_PAGE);
+    check_alignment("global", a, HEAP_ALIGN_PAGE);
+    global_free(a);
+
+    /* bad alignment */
+    if(task_alloc_aligned(16, 24) != NULL)
+        printf("%s: FAIL: accepted an alignment of 24\n", str);
+
+    printf("%s: done\n", str);
+}
+
+void task2(char *str) {
+
+    POOL *pool;
+    REGION *region;
+    HEAP_STATS stats;
+    HANDLE handle[32];
+    void *obj[64];
+    int i;
+
+    if((pool = task_pool_create(24, 64)) == NULL) {
+        printf("%s: FAIL: cannot create pool\n", str);
+        return;
+    }
+
+    for(i = 0; i < 64; i++) {
+        if((obj[i] = pool_get(pool)) == NULL)
+            printf("%s: FAIL: pool empty after %d objects\n", str, i);
+    }
+
+    if(pool_get(pool) != NULL)
+        printf("%s: FAIL: got more objects than the pool holds\n", str);
+
+    for(i = 0; i < 64; i++)
+        pool_put(pool, obj[i]);
+
+    if(pool_put(pool, (UCHAR *)obj[0] + 1) != TASK_ERROR)
+        printf("%s: FAIL: pool accepted a bad pointer\n", str);
+
+    /* a size that wraps around when it is rounded */
+    if(task_pool_create(0xFFFFFFF9, 1) != NULL)
+        printf("%s: FAIL: accepted an object size that wraps\n", str);
+
+    printf("%s: %u of %u objects free\n", str, pool->num_free, pool->count);
+
+    if(task_heap_stats(NULL, &stats) == TASK_SUCCESS)
+        print_stats(str, &stats);
+
+    /* leave this one for the system to clean up */
+    task_pool_create(16, 32);
+
+    /* only prints something when built with HEAP_PROFILE */
+    task_heap_profile(NULL);
+
+    /* a few cycles of scratch buffers */
+    if((region = task_region_create(1024)) == NULL)
+        printf("%s: FAIL: cannot create region\n", str);
+    for(i = 0; region != NULL && i < 4; i++) {
+        while(region_alloc(region, 100) != NULL)
+            ;
+        printf("%s: cycle %d used %u of %u bytes\n", str, i, 
+                region->used, region->size);
+        region_reset(region);
+    }
+    region_destroy(region);
+
+    /* free every other handle, then close up the holes */
+    for(i = 0; i < 32; i++) {
+        if((handle[i] = task_handle_alloc(40)) != NULL)
+            *(int *)*handle[i] = i;
+    }
+    for(i = 0; i < 32; i += 2)
+        handle_free(handle[i]);
+    printf("%s: compaction moved %u blocks\n", str, task_heap_compact(NULL));
+    for(i = 1; i < 32; i += 2) {
+        if(handle[i] == NULL || *(int *)*handle[i] != i)
+            printf("%s: FAIL: handle %d lost it's data\n", str, i);
+    }
+
+    pool_destroy(pool);
+    printf("%s: done\n", str);
+}
+
+void task3(char *str) {
+
+    HEAP_STATS stats;
+    ALLOC_CHECK check;
+    void *buf[16];
+    int i, n = 0;
+
+    /* more than the heap holds, so it has to grow up to the limit */
+    for(i = 0; i < 16; i++) {
+        if((buf[i] = task_alloc(1000)) != NULL)
+            n++;
+    }
+    task_heap_stats(NULL, &stats);
+    printf("%s: %d buffers in a heap of %u bytes\n", str, n, stats.size);
+    if(stats.size > DEFAULT_HEAP_SIZE * 4)
+        printf("%s: FAIL: heap grew past the limit\n", str);
+
+    for(i = 0; i < 16; i++) {
+        if(buf[i] != NULL)
+            task_free(buf[i]);
+    }
+    task_heap_stats(NULL, &stats);
+    printf("%s: heap is %u bytes after freeing\n", str, stats.size);
+
+    /* nothing may be allocated once the task is running for real */
+    task_init_complete(ALLOC_FAIL);
+    if(task_alloc(16) != NULL)
+        printf("%s: FAIL: allocated after init was complete\n", str);
+    task_init_complete(ALLOC_ALLOW);
+    if(alloc_check_report(&check) == TASK_SUCCESS)
+        printf("%s: FAIL: allocation after init was not caught\n", str);
+    else
+        printf("%s: %u allocation(s) after init, first from %p\n", str,
+                check.count, check.caller);
+}
+
+void check_alignment(char *name, void *ptr, UINT align) {
+
+    if(ptr == NULL)
+        printf("%s: FAIL: cannot allocate with alignment %u\n", name, align);
+    else if(((unsigned long)ptr & (align - 1)) != 0)
+        printf("%s: FAIL: %p is not aligned to %u\n", name, ptr, align);
+    else
+        printf("%s: %p aligned to %u\n", name, ptr, align);
+}
+
+void print_stats(char *name, HEAP_STATS *stats) {
+
+    printf("%s: size %u, used %u, free %u, high water %u\n", name,
+            stats->size, stats->used, stats->free, stats->high_water);
+    printf("%s: blocks %u used, %u free, largest free %u, %u%% fragmented\n", 
+            name, stats->used_blocks, stats->free_blocks, 
+            stats->largest_free, stats->fragmentation);
+    printf("%s: %u allocs, %u frees, %u failures\n", name,
+            stats->allocs, stats->frees, stats->failures);
+}
@@ -79,6 +79,9 @@ void task1(char *str) {
             sys_check_stack(tcb));
 
         send_msg_sync(print_task_tcb, (void *)"this isa  test from 1", 100);
+
+        /* a message with no data, just to say something happened */
+        send_msg_sync(print_task_tcb, NULL, 0);
         if(i >= 2)
             break;
         //show_run_queue();
@@ -89,8 +92,28 @@ void task1(char *str) {
 
 void task2(char *str) {
 
-    int i = 0;
+    int i = 0, item;
     TCB *tcb;
+    CHANNEL *ch;
+    WAIT_SOURCE src;
+
+    /* a channel holds fixed size items in the order they were sent */
+    if((ch = channel_create(sizeof(int), 4)) != NULL) {
+        for(i = 0; i < 4; i++)
+            channel_send(ch, &i);
+        src.kind = WAIT_SOURCE_CHANNEL;
+        src.channel = ch;
+        src.mask = WAIT_READ;
+        if(task_wait_any(&src, 1) != 0 || src.ready != WAIT_READ)
+            printf("T2: FAIL: the channel is not ready\n");
+        for(i = 0; i < 4; i++) {
+            channel_receive(ch, &item);
+            if(item != i)
+                printf("T2: FAIL: received %d, expected %d\n", item, i);
+        }
+        channel_destroy(ch);
+    }
+    i = 0;
 
     tcb = get_current_task_tcb();
     while(1) {
@@ -112,6 +135,7 @@ void task3(char *str) {
 
     int i = 0;
     TCB *tcb;
+    char *frame;
 
     tcb = get_current_task_tcb();
     while(1) {
@@ -123,6 +147,12 @@ void task3(char *str) {
             sys_check_stack(tcb));
             
         //raise_signal(NULL, SIGNAL_KILL);
+
+        /* a block of the heap is handed over, not copied */
+        if((frame = task_alloc(32)) != NULL) {
+            sprintf(frame, "frame %d from 3", i);
+            send_msg_buffer(print_task_tcb, frame, 32);
+        }
         
         if(i >= 7)
             break;
@@ -142,6 +172,12 @@ printf("print_task.\n");
     tcb = get_current_task_tcb();
     while(1) {
         mtcb = receive_msg_sync(&strg, &size);
+        if(strg == NULL) {
+            printf("Empty message from 0x%08X\n.", (UINT)mtcb);
+            if(size != 0 || tcb->message_queue->held != NULL)
+                printf("print_task: FAIL: the empty message was kept\n");
+            continue;
+        }
         printf("Message from 0x%08X (%d): \"%s\"\n.", 
                         (UINT)mtcb, size, (char *)strg);
         free_message_data(strg);
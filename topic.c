@@ -0,0 +1,247 @@
+/******************************************************************************
+*
+*   Publish and subscribe.
+*
+*     A topic is something that many tasks want to hear about, such as a
+*   change of state.  Tasks subscribe to it once, and then everything that
+*   is published to the topic is seen by all of them.  Publishing allocates
+*   one record, no matter how many subscribers there are.  The record is
+*   kept in the topic, and each subscriber has a pointer to the first one
+*   that it has not read.  The record counts the subscribers that have not
+*   read it yet, and it is free'd when the last one has.
+*
+*     A subscriber is told that there is something to read with an event of
+*   the topic's type.  The event is part of the subscription, so it is not
+*   allocated either, and it is only queued if it is not queued already.
+*   The task waits for it like any other event, with wait_event_match() or
+*   task_wait_any(), then calls topic_read() until there is nothing left.
+*
+*/
+#include "kern.h"
+
+/* defined in event.c */
+extern int deliver_event(EVENT *event);
+extern int remove_event(TCB *tcb, EVENT *event);
+
+static void read_record(SUBSCRIPTION *sub);
+
+/******************************************************************************
+*
+*   Create a topic on the global heap.  The subscribers are told about new
+*   records with events of "type".  Return NULL if there is no memory.
+*
+*/
+TOPIC *topic_create(UINT type) {
+
+    TOPIC *topic;
+
+    if((topic = global_alloc(sizeof(TOPIC))) == NULL)
+        return NULL;
+
+    topic->type = type;
+
+    return topic;
+}
+
+
+/******************************************************************************
+*
+*   Destroy a topic.  Return TASK_ERROR if it still has subscribers.
+*
+*/
+int topic_destroy(TOPIC *topic) {
+
+    if(topic == NULL || topic->subscribers != 0)
+        return TASK_ERROR;
+
+    return global_free(topic);
+}
+
+
+/******************************************************************************
+*
+*   Subscribe the current task to a topic.  Only what is published from now
+*   on is seen.  Return the subscription, or NULL if there is no memory.
+*
+*/
+SUBSCRIPTION *topic_subscribe(TOPIC *topic) {
+
+    SUBSCRIPTION *sub;
+    TCB *tcb;
+
+    if(topic == NULL || (tcb = get_current_task_tcb()) == NULL)
+        return NULL;
+
+    if((sub = global_alloc(sizeof(SUBSCRIPTION))) == NULL)
+        return NULL;
+
+    sub->topic = topic;
+    sub->tcb = tcb;
+    sub->notice.type = topic->type;
+    sub->notice.destination = tcb;
+    sub->notice.flags = EVENT_STATIC;
+    sub->notice.band = EVENT_BAND_NORMAL;
+
+    sub->next = topic->first;
+    topic->first = sub;
+    topic->subscribers++;
+
+    sub->task_next = tcb->subscriptions;
+    tcb->subscriptions = sub;
+
+    return sub;
+}
+
+
+/******************************************************************************
+*
+*   End a subscription.  Whatever it has not read is dropped.
+*
+*/
+int topic_unsubscribe(SUBSCRIPTION *sub) {
+
+    SUBSCRIPTION **link, *prev;
+
+    if(sub == NULL)
+        return TASK_ERROR;
+
+    for(link = &sub->topic->first; *link != NULL && *link != sub;
+                link = &(*link)->next)
+        ;
+    if(*link == NULL)
+        return TASK_ERROR;
+    *link = sub->next;
+    sub->topic->subscribers--;
+
+    if((prev = sub->tcb->subscriptions) == sub)
+        sub->tcb->subscriptions = sub->task_next;
+    else {
+        while(prev != NULL && prev->task_next != sub)
+            prev = prev->task_next;
+        if(prev != NULL)
+            prev->task_next = sub->task_next;
+    }
+
+    while(sub->unread != NULL)
+        read_record(sub);
+
+    if(TESTFLAG(sub->notice.flags, EVENT_QUEUED))
+        remove_event(sub->tcb, &sub->notice);
+
+    return global_free(sub);
+}
+
+
+/******************************************************************************
+*
+*   Publish something to a topic.  Every subscriber gets the subtype and up
+*   to EVENT_DATA_SIZE bytes of data, and the ones that have read everything
+*   before this are sent a notice.  This does not call the scheduler.
+*
+*/
+int topic_publish(TOPIC *topic, UINT subtype, void *data, UINT size) {
+
+    TOPIC_RECORD *rec;
+    SUBSCRIPTION *sub;
+
+    if(topic == NULL || size > EVENT_DATA_SIZE || (size > 0 && data == NULL))
+        return TASK_ERROR;
+
+    if(topic->subscribers == 0)
+        return TASK_SUCCESS;    /* no one to tell */
+
+    if((rec = global_alloc(sizeof(TOPIC_RECORD))) == NULL)
+        return TASK_ERROR;
+
+    rec->refs = topic->subscribers;
+    rec->subtype = subtype;
+    rec->sender = get_current_task_tcb();
+    copy_memory(rec->data, data, size);
+
+    if(topic->last_record == NULL)
+        topic->first_record = rec;
+    else
+        topic->last_record->next = rec;
+    topic->last_record = rec;
+
+    for(sub = topic->first; sub != NULL; sub = sub->next) {
+        if(sub->unread == NULL)
+            sub->unread = rec;
+        if(!TESTFLAG(sub->notice.flags, EVENT_QUEUED)) {
+            SETFLAG(sub->notice.flags, EVENT_QUEUED);
+            sub->notice.sender = rec->sender;
+            sub->notice.subtype = subtype;
+            deliver_event(&sub->notice);
+        }
+    }
+
+    return TASK_SUCCESS;
+}
+
+
+/******************************************************************************
+*
+*   Read the next record of a subscription.  The subtype and the
+*   EVENT_DATA_SIZE bytes of data are returned, if the pointers are not NULL.
+*   Return the task that published it, or NULL if there is nothing to read.
+*
+*/
+TCB *topic_read(SUBSCRIPTION *sub, UINT *subtype, void *data) {
+
+    TOPIC_RECORD *rec;
+    TCB *sender;
+
+    if(sub == NULL || (rec = sub->unread) == NULL)
+        return NULL;
+
+    sender = rec->sender;
+    if(subtype != NULL)
+        *subtype = rec->subtype;
+    if(data != NULL)
+        copy_memory(data, rec->data, EVENT_DATA_SIZE);
+
+    read_record(sub);
+
+    return sender;
+}
+
+
+/******************************************************************************
+*
+*   End the subscriptions of a task that is exiting.  It's event queue has
+*   been emptied already.
+*
+*/
+void free_task_subscriptions(TCB *tcb) {
+
+    while(tcb->subscriptions != NULL)
+        topic_unsubscribe(tcb->subscriptions);
+}
+
+
+/******************************************************************************
+*
+*   STATIC FUNCTIONS
+*
+*/
+/******************************************************************************
+*
+*   Move a subscription past it's next record.  If it was the last one to
+*   read the record, then the record is free'd.  Records are read in order,
+*   so a record that everyone has read is always the first one.
+*
+*/
+static void read_record(SUBSCRIPTION *sub) {
+
+    TOPIC *topic = sub->topic;
+    TOPIC_RECORD *rec = sub->unread;
+
+    sub->unread = rec->next;
+    if(--rec->refs != 0)
+        return;
+
+    topic->first_record = rec->next;
+    if(topic->last_record == rec)
+        topic->last_record = NULL;
+    global_free(rec);
+}
@@ -0,0 +1,407 @@
+/******************************************************************************
+*
+*   Waiting for more than one thing at once.
+*
+*     task_wait_any() blocks a task until any one of a set of sources is
+*   ready: an event whose type matches a mask, a deadline, a file
+*   descriptor that can be read or written, or a channel that has an item
+*   or room for one.  Messages say that they have
+*   arrived with a MESSAGE_ARRIVAL_EVENT, so they are waited for as events,
+*   with a mask of EVENT_MATCH_TYPE(MESSAGE_ARRIVAL_EVENT).
+*
+*     The task is not run again until a source is ready.  Events wake it up
+*   when they are delivered, the same as for wait_event_match(), and 
+*   channels wake it up when the other side sends or receives.  Deadlines
+*   and file descriptors are checked by the scheduler every time it runs,
+*   through wake_waiters().  When no task is runnable, the scheduler sleeps
+*   in sys_poll() until the nearest deadline or until one of the file
+*   descriptors is ready, so there is no polling in the tasks at all.
+*
+*     The list of tasks that are waiting is kept in records that are on the
+*   stacks of the waiting tasks, since they are there for as long as the
+*   task is blocked.
+*
+*/
+#include <limits.h>
+#include "kern.h"
+
+typedef struct __waiter__ {
+    TCB *tcb;
+    WAIT_SOURCE *sources;
+    UINT count;
+    UINT nfds;      /* how many of the sources are file descriptors */
+    struct __waiter__ *next;
+} WAITER;
+
+static WAITER *waiters = NULL;
+
+/*  File descriptors of all of the waiting tasks, up to WAIT_MAX_FDS */
+static UINT waiting_fds = 0;
+
+static int ready_source(TCB *tcb, WAIT_SOURCE *sources, UINT count);
+static void poll_sources(WAIT_SOURCE *sources, UINT count);
+static void wake_task(TCB *tcb);
+static int check_timers(WAITER *waiter, UINT now, UINT *timeout);
+static void remove_waiter(WAITER *waiter);
+static UINT channel_ready(CHANNEL *ch, UINT mask);
+
+/******************************************************************************
+*
+*   Wait until any one of "count" sources is ready and return the index of
+*   the first one that is.  The "ready" field of each source is set if it is
+*   ready.  Nothing is taken from the source, so the task has to receive the
+*   event or read the file descriptor itself.  Return TASK_ERROR if there
+*   are no sources, one of them is not valid, or there would be more than
+*   WAIT_MAX_FDS file descriptors to poll.
+*
+*/
+int task_wait_any(WAIT_SOURCE *sources, UINT count) {
+
+    WAITER waiter;
+    TCB *tcb;
+    UINT idx, mask = 0, nfds = 0;
+    int ready;
+
+    if((tcb = get_current_task_tcb()) == NULL || sources == NULL || count == 0)
+        return TASK_ERROR;
+
+    for(idx = 0; idx < count; idx++) {
+        sources[idx].ready = 0;
+        switch(sources[idx].kind) {
+            case WAIT_SOURCE_EVENT:
+                /*  Exact types can't be put together in one mask, so wake
+                    up for anything and let ready_source() sort it out. */
+                if(mask == 0)
+                    mask = sources[idx].mask;
+                else if(TESTFLAG(mask | sources[idx].mask, EVENT_MATCH_EXACT))
+                    mask = EVENT_MATCH_ANY;
+                else
+                    mask |= sources[idx].mask;
+                break;
+            case WAIT_SOURCE_TIMER:
+                break;
+            case WAIT_SOURCE_FD:
+                if(sources[idx].fd < 0 ||
+                        !TESTFLAG(sources[idx].mask, WAIT_READ | WAIT_WRITE))
+                    return TASK_ERROR;
+                nfds++;
+                break;
+            case WAIT_SOURCE_CHANNEL:
+                if(sources[idx].channel == NULL ||
+                        !TESTFLAG(sources[idx].mask, WAIT_READ | WAIT_WRITE))
+                    return TASK_ERROR;
+                break;
+            default:
+                return TASK_ERROR;
+        }
+    }
+
+    /*  The scheduler can only poll so many, and one that it left out would
+        never wake the task up.  */
+    if(nfds > WAIT_MAX_FDS - waiting_fds)
+        return TASK_ERROR;
+
+    /*  The scheduler only looks at the records of tasks that are blocked, 
+        so this can go on the list now.  */
+    waiter.tcb = tcb;
+    waiter.sources = sources;
+    waiter.count = count;
+    waiter.nfds = nfds;
+    waiter.next = waiters;
+    waiters = &waiter;
+    waiting_fds += nfds;
+
+    poll_sources(sources, count);
+    while((ready = ready_source(tcb, sources, count)) < 0) {
+        if(mask != 0) {
+            tcb->event_match = mask;
+            SETFLAG(tcb->flags, WAIT_FOR_EVENT);
+        }
+        /*  Only one side of a channel can be blocked on it, and this side 
+            is not ready, so the other side is not blocked.  */
+        for(idx = 0; idx < count; idx++) {
+            if(sources[idx].kind == WAIT_SOURCE_CHANNEL)
+                sources[idx].channel->waiting = tcb;
+        }
+        SETFLAG(tcb->flags, WAIT_FOR_ANY);
+        tcb->status = INCR_STATUS(tcb);
+        yield();
+    }
+
+    remove_waiter(&waiter);
+
+    return ready;
+}
+
+
+/******************************************************************************
+*
+*   Make runnable the waiting tasks that have a timer or file descriptor that
+*   is ready.  This is called by the scheduler every time it runs.  If "idle"
+*   is non-zero, then no task is runnable, and this sleeps until one of the
+*   sources is ready or sys_wake() is called.  Return non-zero if any task is
+*   waiting for a timer or file descriptor.
+*
+*/
+int wake_waiters(int idle) {
+
+    WAITER *waiter;
+    WAIT_SOURCE *fds[WAIT_MAX_FDS];
+    UINT now, idx, nfds = 0, timeout = (UINT)-1;
+    int waiting = 0, wait = 0;
+
+    if(waiters == NULL)
+        return 0;
+
+    now = sys_time();
+    for(waiter = waiters; waiter != NULL; waiter = waiter->next) {
+        if(!TESTFLAG(waiter->tcb->flags, WAIT_FOR_ANY))
+            continue;   /* it is runnable already */
+
+        if(check_timers(waiter, now, &timeout)) {
+            wake_task(waiter->tcb);
+            continue;
+        }
+
+        for(idx = 0; idx < waiter->count; idx++) {
+            if(waiter->sources[idx].kind == WAIT_SOURCE_FD && nfds < WAIT_MAX_FDS)
+                fds[nfds++] = &waiter->sources[idx];
+            waiting |= waiter->sources[idx].kind == WAIT_SOURCE_TIMER ||
+                        waiter->sources[idx].kind == WAIT_SOURCE_FD;
+        }
+    }
+
+    /*  Nothing to sleep on */
+    if(!waiting)
+        return 0;
+
+    if(nfds == 0 && !idle)
+        return waiting;
+
+    /*  No deadline is forever, which is -1 to sys_poll().  A deadline that
+        is too far off for an int is cut short and checked again then. */
+    if(idle)
+        wait = (timeout == (UINT)-1)? -1:
+                    (timeout > INT_MAX)? INT_MAX: (int)timeout;
+
+    if(sys_poll(fds, nfds, wait) <= 0 && !idle)
+        return waiting;
+
+    /*  Something is ready, or the deadline has passed.  Find the tasks. */
+    now = sys_time();
+    for(waiter = waiters; waiter != NULL; waiter = waiter->next) {
+        if(TESTFLAG(waiter->tcb->flags, WAIT_FOR_ANY) &&
+                    (check_timers(waiter, now, &timeout) ||
+                     ready_source(waiter->tcb, waiter->sources,
+                                  waiter->count) >= 0))
+            wake_task(waiter->tcb);
+    }
+
+    return waiting;
+}
+
+
+/******************************************************************************
+*
+*   A task that is waiting in task_wait_any() is on the "waiting" list of a
+*   channel that was just sent to or received from.  Make it runnable, if it
+*   is still blocked.  If "closed" is non-zero, then the channel is going 
+*   away, so it is taken out of the task's sources, which are then ready.
+*   This is called by channel.c.
+*
+*/
+void wake_channel_waiter(CHANNEL *ch, TCB *tcb, int closed) {
+
+    WAITER *waiter;
+    UINT idx;
+
+    if(closed) {
+        for(waiter = waiters; waiter != NULL; waiter = waiter->next) {
+            if(waiter->tcb != tcb)
+                continue;
+            for(idx = 0; idx < waiter->count; idx++) {
+                if(waiter->sources[idx].kind == WAIT_SOURCE_CHANNEL &&
+                            waiter->sources[idx].channel == ch)
+                    waiter->sources[idx].channel = NULL;
+            }
+        }
+    }
+
+    if(TESTFLAG(tcb->flags, WAIT_FOR_ANY))
+        wake_task(tcb);
+}
+
+
+/******************************************************************************
+*
+*   Take a task that is exiting off of the list of waiting tasks.
+*
+*/
+void free_task_waits(TCB *tcb) {
+
+    WAITER *waiter;
+
+    for(waiter = waiters; waiter != NULL; waiter = waiter->next) {
+        if(waiter->tcb == tcb) {
+            remove_waiter(waiter);
+            return;
+        }
+    }
+}
+
+
+/******************************************************************************
+*
+*   STATIC FUNCTIONS
+*
+*/
+/******************************************************************************
+*
+*   Set the ready field of each source and return the index of the first
+*   one that is ready, or -1 if none are.  The file descriptors are not
+*   polled here, their ready fields are set by sys_poll().
+*
+*/
+static int ready_source(TCB *tcb, WAIT_SOURCE *sources, UINT count) {
+
+    UINT idx, now;
+    int ready = -1;
+
+    now = sys_time();
+    for(idx = 0; idx < count; idx++) {
+        switch(sources[idx].kind) {
+            case WAIT_SOURCE_EVENT:
+                sources[idx].ready = event_pending(tcb, sources[idx].mask);
+                break;
+            case WAIT_SOURCE_TIMER:
+                sources[idx].ready = (int)(now - sources[idx].deadline) >= 0;
+                break;
+            case WAIT_SOURCE_FD:
+                break;
+            case WAIT_SOURCE_CHANNEL:
+                sources[idx].ready = channel_ready(sources[idx].channel,
+                                                   sources[idx].mask);
+                break;
+        }
+        if(sources[idx].ready && ready < 0)
+            ready = (int)idx;
+    }
+
+    return ready;
+}
+
+
+/******************************************************************************
+*
+*   Set the ready fields of the file descriptors in a set of sources.
+*
+*/
+static void poll_sources(WAIT_SOURCE *sources, UINT count) {
+
+    WAIT_SOURCE *fds[WAIT_MAX_FDS];
+    UINT idx, nfds = 0;
+
+    for(idx = 0; idx < count && nfds < WAIT_MAX_FDS; idx++) {
+        if(sources[idx].kind == WAIT_SOURCE_FD)
+            fds[nfds++] = &sources[idx];
+    }
+
+    if(nfds != 0)
+        sys_poll(fds, nfds, 0);
+}
+
+
+/******************************************************************************
+*
+*   Make a task that is blocked in task_wait_any() runnable.  An event that
+*   is delivered to it does the same thing, see deliver_event() in event.c.
+*
+*/
+static void wake_task(TCB *tcb) {
+
+    if(tcb->status == TASK_KILLED)
+        return;     /* it will be deleted, leave it that way */
+
+    CLEARFLAG(tcb->flags, WAIT_FOR_ANY | WAIT_FOR_EVENT);
+    tcb->status = DECR_STATUS(tcb);
+}
+
+
+/******************************************************************************
+*
+*   Return non-zero if a timer of a waiting task has expired.  Otherwise keep
+*   the time to the nearest deadline in "timeout".
+*
+*/
+static int check_timers(WAITER *waiter, UINT now, UINT *timeout) {
+
+    WAIT_SOURCE *source;
+    UINT idx;
+
+    for(idx = 0; idx < waiter->count; idx++) {
+        source = &waiter->sources[idx];
+        if(source->kind != WAIT_SOURCE_TIMER)
+            continue;
+        if((int)(now - source->deadline) >= 0)
+            return 1;
+        if(source->deadline - now < *timeout)
+            *timeout = source->deadline - now;
+    }
+
+    return 0;
+}
+
+
+/******************************************************************************
+*
+*   Return which of WAIT_READ and WAIT_WRITE in "mask" a channel is ready
+*   for.  A channel that was destroyed is ready for both, so that the task
+*   finds out when it uses it, the same as for a file descriptor that was
+*   hung up.
+*
+*/
+static UINT channel_ready(CHANNEL *ch, UINT mask) {
+
+    UINT ready = 0;
+
+    if(ch == NULL)
+        return mask;
+
+    if(TESTFLAG(mask, WAIT_READ) && ch->count > 0)
+        SETFLAG(ready, WAIT_READ);
+    if(TESTFLAG(mask, WAIT_WRITE) && ch->count < ch->slots)
+        SETFLAG(ready, WAIT_WRITE);
+
+    return ready;
+}
+
+
+/******************************************************************************
+*
+*   Take a record off of the list of waiting tasks, if it is there.  The
+*   task is taken off of the channels that it was waiting for, too.
+*
+*/
+static void remove_waiter(WAITER *waiter) {
+
+    WAITER **link;
+    CHANNEL *ch;
+    UINT idx;
+
+    for(idx = 0; idx < waiter->count; idx++) {
+        if(waiter->sources[idx].kind != WAIT_SOURCE_CHANNEL)
+            continue;
+        ch = waiter->sources[idx].channel;
+        if(ch != NULL && ch->waiting == waiter->tcb)
+            ch->waiting = NULL;
+    }
+
+    for(link = &waiters; *link != NULL; link = &(*link)->next) {
+        if(*link == waiter) {
+            *link = waiter->next;
+            waiter->next = NULL;
+            waiting_fds -= waiter->nfds;
+            return;
+        }
+    }
+}
@@ -9,6 +9,9 @@
 #include "system.h"
 #include "../kern.h"
 
+/*  Milliseconds since the timer was started, see sys_tick() */
+static volatile UINT ticks;
+
 /******************************************************************************
 *
 *   This function is called by task_create() to set up the stack frame.
@@ -118,6 +121,65 @@ void halt_processor() {
     /* do nothing for now... */
 }
 
+/******************************************************************************
+*
+*   Count a millisecond.  This is called by the timer interrupt, which has to
+*   be set up to go off once a millisecond.
+*
+*/
+void sys_tick(void) {
+
+    ticks++;
+}
+
+/******************************************************************************
+*
+*   Return the time in milliseconds from when the timer was started.  It 
+*   wraps around after about 49 days, so times have to be compared by 
+*   subtracting.
+*
+*/
+UINT sys_time(void) {
+
+    return ticks;
+}
+
+/******************************************************************************
+*
+*   There are no file descriptors, so none of the wait sources are ever 
+*   ready, and there is nothing to sleep on.  Return 0.
+*
+*/
+int sys_poll(WAIT_SOURCE **sources, UINT count, int timeout) {
+
+    UINT idx;
+
+    for(idx = 0; idx < count; idx++)
+        sources[idx]->ready = 0;
+
+    return 0;
+}
+
+/******************************************************************************
+*
+*   Set up what sys_wake() needs.  Nothing is needed, since 
+*   halt_processor() does not sleep.
+*
+*/
+int sys_wake_init(void) {
+
+    return TASK_SUCCESS;
+}
+
+/******************************************************************************
+*
+*   End halt_processor().  It does not sleep, so there is nothing to do.
+*
+*/
+void sys_wake(void) {
+
+}
+
 /******************************************************************************
 *
 *   Check the aproximate amount of stack in use.  Count from the end of the
@@ -153,3 +215,19 @@ int sys_check_stack(TCB *tcb) {
     return val;
 }
 
+/******************************************************************************
+*
+*   Get the memory that the global heap is made from.  There is no operating
+*   system to ask, so it is a static region of SYSTEM_MEMORY_SIZE bytes.  The
+*   flags do not mean anything here.  Nothing is paged, so the memory is 
+*   always present and locked.
+*/
+UCHAR *sys_get_memory(UINT size, UINT flags) {
+
+    static UCHAR system_memory[SYSTEM_MEMORY_SIZE];
+
+    if(size > sizeof(system_memory))
+        return NULL;
+
+    return system_memory;
+}
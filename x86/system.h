@@ -9,4 +9,15 @@
 #define save_task_context(c)        setjmp(c)
 #define restore_task_context(c, v)  longjmp(c, v)
 
+/* There is only one thread of execution, so locks and thread local data 
+    are not needed. */
+typedef int SYS_LOCK;
+#define SYS_LOCK_INITIALIZER        0
+#define sys_lock(l)                 ((void)(l))
+#define sys_unlock(l)               ((void)(l))
+#define SYS_THREAD_LOCAL
+
+/* the timer interrupt calls this once a millisecond, for sys_time() */
+void sys_tick(void);
+
 #endif /* __SYSTEM_HEADER_DEFINED__ */